@@ -0,0 +1,201 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+/// g++ -std=c++17 -O2 -march=native -Wall bench.cpp -lpthread -o bench && ./bench
+///
+/// Measures the throughput of the correlator in samples per second for several code lengths and oversampling
+/// factors, in the acquisition and the tracking stages, and compares it against the real-time budget:
+/// the correlator of a profile whose chip period equals side_channel::params::BaseChipPeriod receives one sample
+/// per base chip period per unit of oversampling, which is the highest sample rate of any link.
+
+#include "side_channel_params.hpp"
+#include "side_channel_code.hpp"
+#include "side_channel_rx.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+/// Each measurement runs for at least this long.
+static constexpr std::chrono::milliseconds MeasurementDuration{300};
+
+enum class Mode
+{
+    Acquisition,        ///< Every channel is updated on every sample; the input is noise, so there is no lock.
+    Tracking,           ///< The DLL is tracking a clean signal, so only the tracked channels are updated.
+    BlockAcquisition,   ///< Same as the acquisition, but one code period at a time via the FFT (feedBlock()).
+};
+
+static const char* getModeName(const Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::Acquisition:      return "acquisition";
+    case Mode::Tracking:         return "tracking";
+    case Mode::BlockAcquisition: return "block";
+    }
+    return "?";
+}
+
+/// The samples are generated ahead of time, so that the generator is not measured.
+template <typename Sample>
+static std::vector<Sample> makeNoise(const std::size_t size)
+{
+    std::mt19937 rng(42);
+    std::normal_distribution<float> dist(0.0F, 1.0F);
+    std::vector<Sample> out(size);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        const float v = dist(rng);
+        if constexpr (std::is_same_v<Sample, bool>)
+        {
+            out[i] = v > 0.0F;
+        }
+        else
+        {
+            out[i] = v;
+        }
+    }
+    return out;
+}
+
+/// A clean signal of random bits, one per code period, with the chips expanded by the oversampling factor.
+template <typename Sample, std::uint32_t Oversampling, typename Code>
+static std::vector<Sample> makeSignal(const Code& code, const std::size_t periods)
+{
+    std::mt19937 rng(42);
+    std::vector<Sample> out;
+    out.reserve(periods * Code::Length * Oversampling);
+    for (std::size_t p = 0; p < periods; p++)
+    {
+        const bool bit = (p < 20U) || ((rng() & 1U) != 0U);   // The preamble is needed for the acquisition.
+        for (auto i = 0U; i < Code::Length; i++)
+        {
+            const bool chip = code[i] == bit;
+            for (auto j = 0U; j < Oversampling; j++)
+            {
+                if constexpr (std::is_same_v<Sample, bool>)
+                {
+                    out.push_back(chip);
+                }
+                else
+                {
+                    out.push_back(chip ? 1.0F : -1.0F);
+                }
+            }
+        }
+    }
+    return out;
+}
+
+/// Returns the throughput in samples per second, or zero if the correlator could not lock onto the signal.
+template <typename Code, typename Sample, std::uint32_t Oversampling>
+static double measure(const Code& code, const Mode mode)
+{
+    using Correlator = side_channel::rx::Correlator<Code, Sample, 0, Oversampling>;
+    constexpr auto SequenceLength = Correlator::SequenceLength;
+    auto correlator = std::make_unique<Correlator>(code);
+    const auto samples = (mode == Mode::Tracking) ? makeSignal<Sample, Oversampling>(code, 64)
+                                                  : makeNoise<Sample>(SequenceLength * 4U);
+    std::size_t index = 0;
+    if (mode == Mode::Tracking)
+    {
+        while (!correlator->isTracking())
+        {
+            if (index >= samples.size())
+            {
+                return 0.0;
+            }
+            (void)correlator->feed(samples[index++]);
+        }
+    }
+    volatile float sink = 0.0F;     // Keeps the results from being optimized away.
+    std::uint64_t count = 0;
+    std::vector<Sample> block(SequenceLength);
+    const auto started_at = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    while (elapsed < MeasurementDuration)
+    {
+        if (mode == Mode::BlockAcquisition)
+        {
+            for (std::size_t i = 0; i < block.size(); i++)     // Not a range loop because of std::vector<bool>.
+            {
+                block[i] = samples[index++ % samples.size()];
+            }
+            for (const auto& r : correlator->feedBlock(block))
+            {
+                sink = sink + r.data;
+            }
+            count += SequenceLength;
+        }
+        else
+        {
+            for (auto i = 0U; i < 256U; i++)
+            {
+                sink = sink + correlator->feed(samples[index++ % samples.size()]).data;
+            }
+            count += 256U;
+            // Stay on the signal rather than wrapping around into the discontinuity.
+            if ((mode == Mode::Tracking) && ((index + 256U) >= samples.size()))
+            {
+                index = (index % (Code::Length * Oversampling)) + (Code::Length * Oversampling * 32U);
+            }
+        }
+        elapsed = std::chrono::steady_clock::now() - started_at;
+    }
+    if ((mode == Mode::Tracking) && !correlator->isTracking())
+    {
+        return 0.0;
+    }
+    return double(count) / std::chrono::duration<double>(elapsed).count();
+}
+
+template <typename Code, typename Sample, std::uint32_t Oversampling>
+static void benchmark(const char* const name, const Code& code)
+{
+    // The highest sample rate of any link for this oversampling factor.
+    const double budget = Oversampling / std::chrono::duration<double>(side_channel::params::BaseChipPeriod).count();
+    for (const auto mode : {Mode::Acquisition, Mode::Tracking, Mode::BlockAcquisition})
+    {
+        const double rate = measure<Code, Sample, Oversampling>(code, mode);
+        std::printf("%-10s %5u %3u  %-5s %-12s %12.0f %9.0f %9.1fx%s\n",
+                    name,
+                    static_cast<unsigned>(Code::Length),
+                    static_cast<unsigned>(Oversampling),
+                    std::is_same_v<Sample, bool> ? "hard" : "soft",
+                    getModeName(mode),
+                    rate,
+                    budget,
+                    rate / budget,
+                    (rate < budget) ? "  TOO SLOW" : "");
+        std::fflush(stdout);
+    }
+}
+
+template <typename Code, std::uint32_t... Oversampling>
+static void benchmarkCode(const char* const name,
+                          const Code&       code,
+                          std::integer_sequence<std::uint32_t, Oversampling...>)
+{
+    (benchmark<Code, float, Oversampling>(name, code), ...);
+    (benchmark<Code, bool, Oversampling>(name, code), ...);
+}
+
+int main()
+{
+    namespace code = side_channel::code;
+    using Factors = std::integer_sequence<std::uint32_t, 1, 2, 3, 4>;
+    std::printf("The receiver uses the oversampling factor %u with the %s decision correlation in %s mode.\n",
+                static_cast<unsigned>(side_channel::rx::OversamplingFactor),
+                side_channel::rx::SoftDecision ? "soft" : "hard",
+                side_channel::rx::BlockCorrelation ? "block" : "streaming");
+    std::printf("%-10s %5s %3s  %-5s %-12s %12s %9s %10s\n",
+                "code", "len", "os", "dec", "mode", "samples/s", "budget", "headroom");
+    benchmarkCode("gold63", code::Gold63::makeTable().front(), Factors{});
+    benchmarkCode("kasami255", code::Kasami255::makeTable().front(), Factors{});
+    benchmarkCode("gps-ca", code::GPSCA::make<1>(), Factors{});
+    benchmarkCode("gold2047", code::makeGold2047<1>(), Factors{});
+    benchmarkCode("mseq4095", code::makeMSequence4095(), Factors{});
+    return 0;
+}
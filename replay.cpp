@@ -0,0 +1,237 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+/// g++ -std=c++17 -O2 -march=native -Wall replay.cpp -lpthread -o replay && ./replay trace.bin
+
+#include "side_channel_params.hpp"
+#include "side_channel_lanes.hpp"
+#include "side_channel_segment.hpp"
+#include "side_channel_arq.hpp"
+#include "side_channel_trace.hpp"
+#include "side_channel_rx.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Thrown by the replay source once the trace is exhausted.
+class EndOfTrace : public std::runtime_error
+{
+public:
+    EndOfTrace() : std::runtime_error("End of trace") { }
+};
+
+/// Feeds the measurements of the specified cores from the trace to the decoder as fast as it consumes them.
+/// The sampling windows of the trace are fixed, so the rate correction reported by the decoder cannot be applied;
+/// the delay-locked loop of the correlator follows the drift, like it does for every link but the first one
+/// in the live receiver (see Sampler::Port::setRateCorrection()).
+class TraceReplay : public side_channel::rx::PHYSource
+{
+public:
+    TraceReplay(const side_channel::trace::Reader& trace, std::vector<unsigned> cores) :
+        trace_(trace),
+        cores_(std::move(cores))
+    { }
+
+    side_channel::rx::PHYMeasurement next() override
+    {
+        if (index_ >= trace_.size())
+        {
+            throw EndOfTrace();
+        }
+        side_channel::rx::PHYMeasurement out;
+        out.timestamp = side_channel::FastClock::time_point(std::chrono::nanoseconds(trace_.getTimestamp(index_)));
+        out.elapsed_ns = trace_.getElapsed(index_);
+        for (auto core : cores_)
+        {
+            out.count += (core < trace_.getCoreCount()) ? trace_.getCount(index_, core) : 0U;
+        }
+        index_++;
+        return out;
+    }
+
+    std::uint64_t getOverrunCount() const override { return 0; }
+
+    void setRateCorrection(const double) override { }
+
+private:
+    const side_channel::trace::Reader& trace_;
+    const std::vector<unsigned> cores_;
+    std::size_t index_ = 0;
+};
+
+static const char* getFrameTypeName(const side_channel::params::FrameType type)
+{
+    using side_channel::params::FrameType;
+    switch (type)
+    {
+    case FrameType::Data:                return "data";
+    case FrameType::ProfileAnnouncement: return "announcement";
+    case FrameType::Segment:             return "segment";
+    case FrameType::Poll:                return "poll";
+    case FrameType::Ack:                 return "ack";
+    }
+    return "unknown";
+}
+
+/// The frames decoded from one lane of one link, by type.
+using Statistics = std::map<side_channel::params::FrameType, unsigned>;
+
+/// Decodes one lane of one link from the whole trace and prints every frame with its time since the start
+/// of the trace. The per-bit diagnostics are printed only if verbose, because they dominate the replay time.
+static Statistics replay(const side_channel::trace::Reader& trace,
+                         const unsigned                     prn,
+                         const std::vector<unsigned>&       cores,
+                         const bool                         verbose)
+{
+    using side_channel::params::FrameType;
+    const auto name = "prn" + std::to_string(prn);
+    const auto start = side_channel::FastClock::time_point(std::chrono::nanoseconds(trace.getTimestamp(0)));
+    TraceReplay source(trace, cores);
+    side_channel::rx::PacketReader reader(source, prn, name);
+    reader.setDiagnosticsEnabled(verbose);
+    Statistics out;
+    try
+    {
+        for (;;)
+        {
+            const auto frame = reader.next();
+            const double at = std::chrono::duration<double>(reader.getTime() - start).count();
+            out[frame.type]++;
+            std::printf("%s: %9.3f s: %s frame of %u bytes",
+                        name.c_str(), at, getFrameTypeName(frame.type), static_cast<unsigned>(frame.payload.size()));
+            if (frame.type == FrameType::Segment)
+            {
+                if (const auto h = side_channel::segment::parseSegmentHeader(frame.payload))
+                {
+                    std::printf(": file %08x segment %u/%u",
+                                static_cast<unsigned>(h->file_id),
+                                static_cast<unsigned>(h->index + 1U),
+                                static_cast<unsigned>(h->count));
+                }
+            }
+            else if (frame.type == FrameType::Ack)
+            {
+                if (const auto ack = side_channel::arq::parseAck(frame.payload))
+                {
+                    std::printf(": file %08x base %u", static_cast<unsigned>(ack->file_id), ack->base);
+                }
+            }
+            std::printf("\n");
+        }
+    }
+    catch (const EndOfTrace&)
+    {
+        std::fflush(stdout);
+    }
+    return out;
+}
+
+/// Each lane of each link is decoded from the same mapping of the trace by its own thread, so the links are
+/// replayed at once. The lanes are derived from the core count of the recorder rather than of the local host.
+int main(const int argc, const char* const argv[])
+{
+    std::string path;
+    std::vector<unsigned> prns;
+    unsigned lane_count = 1;
+    bool verbose = false;
+    for (auto i = 1; i < argc; i++)
+    {
+        const std::string arg(argv[i]);
+        if (arg.rfind("--prn=", 0) == 0)
+        {
+            prns.push_back(static_cast<unsigned>(std::stoul(arg.substr(6))));
+        }
+        else if (arg.rfind("--lanes=", 0) == 0)
+        {
+            lane_count = static_cast<unsigned>(std::stoul(arg.substr(8)));
+        }
+        else if (arg == "--verbose")
+        {
+            verbose = true;
+        }
+        else if (path.empty() && (arg.rfind("--", 0) != 0))
+        {
+            path = arg;
+        }
+        else
+        {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty() || (lane_count == 0U))
+    {
+        std::cerr << "Usage:\n\t" << argv[0] << " [--prn=N]... [--lanes=N] [--verbose] <trace>" << std::endl;
+        return 1;
+    }
+    if (prns.empty())
+    {
+        prns.push_back(1);
+    }
+    const side_channel::trace::Reader trace(path);
+    if ((trace.size() == 0U) || (lane_count > trace.getCoreCount()))
+    {
+        std::cerr << "The trace contains " << trace.size() << " records of " << trace.getCoreCount()
+                  << " cores, which is not enough" << std::endl;
+        return 1;
+    }
+    const auto sample_duration =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(side_channel::rx::SampleDuration);
+    const double duration_s = std::chrono::duration<double>(std::chrono::nanoseconds(
+        trace.getTimestamp(trace.size() - 1U) - trace.getTimestamp(0))).count();
+    std::cout << "TRACE:              " << trace.size() << " records of " << trace.getCoreCount() << " cores, "
+              << duration_s << " s" << std::endl;
+    if (trace.getSampleDuration() != sample_duration)
+    {
+        std::cout << "WARNING: the trace was recorded with the sample duration of "
+                  << trace.getSampleDuration().count() << " ns, expected " << sample_duration.count() << " ns"
+                  << std::endl;
+    }
+
+    struct Job
+    {
+        unsigned prn = 0;
+        Statistics result;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Job>> jobs;
+    const auto started_at = std::chrono::steady_clock::now();
+    for (auto prn : prns)
+    {
+        // Fail early if the PRN number of any lane is invalid.
+        (void) side_channel::params::RobustProfile::getCode(prn + lane_count - 1U);
+        for (auto lane = 0U; lane < lane_count; lane++)
+        {
+            auto job = std::make_unique<Job>();
+            job->prn = prn + lane;
+            const auto cores = side_channel::lanes::getLaneCores(lane, lane_count, trace.getCoreCount());
+            job->thread = std::thread([&trace, cores, verbose, j = job.get()]()
+            {
+                j->result = replay(trace, j->prn, cores, verbose);
+            });
+            jobs.push_back(std::move(job));
+        }
+    }
+    for (auto& j : jobs)
+    {
+        j->thread.join();
+    }
+    const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+    for (const auto& j : jobs)
+    {
+        std::printf("prn%u:", j->prn);
+        for (const auto& [type, count] : j->result)
+        {
+            std::printf(" %u %s", count, getFrameTypeName(type));
+        }
+        std::printf(" frames\n");
+    }
+    std::printf("replayed %.1f s of signal in %.1f s, %.1fx real time\n",
+                duration_s, elapsed_s, (elapsed_s > 0.0) ? (duration_s / elapsed_s) : 0.0);
+    return 0;
+}
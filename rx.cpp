@@ -1,432 +1,542 @@
 /// Pavel Kirienko <pavel@uavcan.org>
 /// Distributed under the terms of the MIT license.
-/// g++ -std=c++17 -O2 -Wall rx.cpp -lpthread -o rx && ./rx
+/// g++ -std=c++17 -O2 -march=native -Wall rx.cpp -lpthread -o rx && ./rx
 
 #include "side_channel_params.hpp"
+#include "side_channel_lanes.hpp"
+#include "side_channel_segment.hpp"
+#include "side_channel_rx.hpp"
+#include "side_channel_tx.hpp"
+#include "side_channel_arq.hpp"
+#include "side_channel_trace.hpp"
+#include "side_channel_shm.hpp"
+#include "side_channel_telemetry.hpp"
 #include <cstdio>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <thread>
 #include <vector>
-#include <type_traits>
 #include <algorithm>
-#include <numeric>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <deque>
 #include <optional>
-#include <cassert>
-#include <tuple>
-#include <variant>
-#include <cmath>
-
-static constexpr auto OversamplingFactor = 3;
-static constexpr auto SampleDuration = side_channel::params::ChipPeriod / OversamplingFactor;
-static constexpr auto PHYAveragingFactor = 8;
-
-/// Compute mean and standard deviation for the set.
-template <typename S>
-inline std::pair<S, S> computeMeanStdev(const std::vector<S>& cvec)
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Reassembles the files from their segments (see side_channel_segment.hpp). Each segment is written into the output
+/// file at its offset as soon as it arrives, so the memory footprint does not depend on the size of the file;
+/// the output file is preallocated when the first segment of the file arrives. The segments are delivered by the
+/// receiver threads of all lanes of the link in any order, so the assembler is shared by them.
+/// If there are too many incomplete files, the oldest one is abandoned, leaving the partial file on the disk.
+class SegmentAssembler
 {
-    const auto mean = std::accumulate(std::begin(cvec), std::end(cvec), 0.0F) / cvec.size();
-    auto variance = S{};
-    for (auto e : cvec)
+public:
+    explicit SegmentAssembler(const unsigned prn) : prn_(prn) { }
+
+    ~SegmentAssembler()
     {
-        variance += std::pow(e - mean, 2) / cvec.size();
+        for (auto& f : files_)
+        {
+            (void)::close(f.fd);
+        }
     }
-    return {mean, std::sqrt(variance)};
-}
 
-/// Returns true if the PHY is driven high by the transmitter, false otherwise.
-static bool readPHY()
-{
-    // Use delta relative to fixed state to avoid accumulation of phase error, because phase error attenuates the
-    // useful signal at the receiver. TODO: Implement automatic frequency alignment via PLL
-    static auto deadline = std::chrono::steady_clock::now();
-    deadline += SampleDuration;
-    const auto started_at = std::chrono::steady_clock::now();
+    SegmentAssembler(const SegmentAssembler&) = delete;
+    SegmentAssembler& operator=(const SegmentAssembler&) = delete;
 
-    // Run counter threads to measure ticks per unit time.
-    std::vector<std::int64_t> counters;
-    const auto loop = [&counters](std::uint32_t index) {
-        auto& cnt = counters.at(index);
-        while (std::chrono::steady_clock::now() < deadline)
+    /// Thread-safe.
+    void add(const std::vector<std::uint8_t>& segment)
+    {
+        const auto header = side_channel::segment::parseSegmentHeader(segment);
+        if (!header)
         {
-            cnt++;
+            std::printf("PRN %u: invalid segment\n", prn_);
+            return;
         }
-    };
-    static const auto thread_count = std::max<unsigned>(1, std::min<unsigned>(MAX_CONCURRENCY,
-                                                                              std::thread::hardware_concurrency()));
-    if (thread_count > 1U)
-    {
-        counters.resize(thread_count, 0);
-        std::vector<std::thread> pool;
-        for (auto i = 0U; i < thread_count; i++)
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (isCompleted(header->file_id))
         {
-            pool.emplace_back(loop, i);
+            return;     // Resent because the acknowledgement was lost; see side_channel_arq.hpp.
         }
-        for (auto& t : pool)
+        auto& file = open(*header);
+        if ((file.received.size() != header->count) || (file.segment_size != header->segment_size))
         {
-            t.join();
+            std::printf("PRN %u: file %08x: inconsistent segment\n", prn_, static_cast<unsigned>(file.id));
+            return;
+        }
+        if (file.received.at(header->index))
+        {
+            return;     // Duplicate.
+        }
+        const auto data_size = segment.size() - side_channel::segment::Header::Size;
+        const auto offset = header->getOffset();
+        if (::pwrite(file.fd,
+                     segment.data() + side_channel::segment::Header::Size,
+                     data_size,
+                     static_cast<off_t>(offset)) != static_cast<ssize_t>(data_size))
+        {
+            std::printf("PRN %u: could not write file %s\n", prn_, file.name.c_str());
+            std::exit(1);
+        }
+        file.received.at(header->index) = true;
+        file.received_count++;
+        if ((header->index + 1U) == header->count)
+        {
+            file.size = offset + data_size;
+        }
+        std::printf("PRN %u: file %08x: segment %u/%u received, %u remaining\n",
+                    prn_,
+                    static_cast<unsigned>(file.id),
+                    static_cast<unsigned>(header->index + 1U),
+                    static_cast<unsigned>(header->count),
+                    static_cast<unsigned>(header->count - file.received_count));
+        if (file.received_count == header->count)
+        {
+            complete(file);
         }
     }
-    else  // Otherwise run in the main thread to take advantage of the CPU core affinity.
+
+    /// The selective acknowledgement of the file as of now; see side_channel_arq.hpp. Thread-safe.
+    /// The completed files are remembered, so that their acknowledgement can be repeated if it was lost.
+    side_channel::arq::Ack getAck(const std::uint32_t file_id)
     {
-        counters.push_back(0);
-        loop(0);
+        std::lock_guard<std::mutex> lock(mutex_);
+        side_channel::arq::Ack out;
+        out.file_id = file_id;
+        const auto it = std::find_if(std::begin(files_), std::end(files_),
+                                     [file_id](const File& f) { return f.id == file_id; });
+        if (it != std::end(files_))
+        {
+            while ((out.base < it->received.size()) && it->received[out.base])
+            {
+                out.base++;
+            }
+            for (auto index = out.base; index < it->received.size(); index++)
+            {
+                if (it->received[index])
+                {
+                    out.setReceived(index);
+                }
+            }
+        }
+        else if (const auto done = findCompleted(file_id); done != std::end(completed_))
+        {
+            out.base = done->second;
+        }
+        return out;
     }
 
-    // Estimate the tick rate.
-    const double elapsed_ns =
-        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_at).count();
-    const double rate = double(std::accumulate(std::begin(counters), std::end(counters), 0)) / elapsed_ns;
-
-    // Apply high-pass filtering to eliminate DC component.
-    static double rate_average = rate;
-    rate_average += (rate - rate_average) / PHYAveragingFactor;
+private:
+    static constexpr std::size_t MaxIncompleteFiles = 4;
+    static constexpr std::size_t MaxCompletedFiles = 16;
 
-    // A smaller counter value means that the CPU time is being consumed by the sender, meaning it's the high level.
-    return rate < rate_average;
-}
+    struct File
+    {
+        std::uint32_t id = 0;
+        std::string name;
+        int fd = -1;
+        std::uint16_t segment_size = 0;
+        std::vector<bool> received;     ///< Indexed by segment.
+        std::uint32_t received_count = 0;
+        std::uint64_t size = 0;         ///< Known once the last segment is received.
+    };
 
-/// Estimates correlation of the real-time input signal against the reference CDMA spread code (chip code).
-/// The correlator runs a set of channels concurrently, separated by a fixed phase offset.
-/// The correlation estimate ranges in [0.0, 1.0], where 0 represents uncorrelated signal, 1 for perfect correlation.
-class CorrelationChannel
-{
-public:
-    CorrelationChannel(std::vector<bool> spread_code, const std::uint32_t offset) :
-        spread_code_(spread_code),
-        position_(offset)
-    { }
+    using Completed = std::deque<std::pair<std::uint32_t, std::uint32_t>>;     ///< File ID and segment count.
 
-    /// The bit clock can be trivially extracted from a code phase locked CDMA link.
-    /// In this implementation, the leading edge of the clock occurs near the middle of the spread code period.
-    /// The clock edge lags the bit it relates to by one spread code period.
-    struct Result
+    Completed::const_iterator findCompleted(const std::uint32_t file_id) const
     {
-        float correlation = 0.0F;
-        bool data;
-        bool clock;
-    };
+        return std::find_if(std::begin(completed_), std::end(completed_),
+                            [file_id](const auto& c) { return c.first == file_id; });
+    }
+    bool isCompleted(const std::uint32_t file_id) const { return findCompleted(file_id) != std::end(completed_); }
 
-    Result feed(const bool sample)
+    File& open(const side_channel::segment::Header& header)
     {
-        std::optional<bool> received;
-        if (position_ >= spread_code_.size())
+        const auto it = std::find_if(std::begin(files_), std::end(files_),
+                                     [&header](const File& f) { return f.id == header.file_id; });
+        if (it != std::end(files_))
         {
-            updateCorrelation();
-            state_ = match_hi_ > match_lo_;
-            position_ = 0;
-            match_hi_ = 0;
-            match_lo_ = 0;
+            return *it;
         }
-        if (sample == spread_code_.at(position_))
+        if (files_.size() >= MaxIncompleteFiles)
         {
-            match_hi_++;
+            std::printf("PRN %u: file %08x abandoned\n", prn_, static_cast<unsigned>(files_.front().id));
+            (void)::close(files_.front().fd);
+            files_.pop_front();
         }
-        else
+        File file;
+        file.id = header.file_id;
+        file.segment_size = header.segment_size;
+        file.received.resize(header.count, false);
+        char name[64]{};
+        std::snprintf(name, sizeof(name), "%08x_prn%u.bin", static_cast<unsigned>(header.file_id), prn_);
+        file.name = name;
+        file.fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file.fd < 0)
         {
-            match_lo_++;
+            std::printf("Could not open file %s\n", name);
+            std::exit(1);
         }
-        position_++;
-        return {
-            correlation_,
-            state_,
-            position_ > spread_code_.size() / 2
-        };
-    }
-
-    /// Diagnistic accessor. Not part of the main business logic.
-    float getCorrelation() const { return correlation_; }
-
-private:
-    void updateCorrelation()
-    {
-        const bool hi_top = match_hi_ > match_lo_;
-        const auto top = hi_top ? match_hi_ : match_lo_;
-        const auto bot = hi_top ? match_lo_ : match_hi_;
-        assert(top >= bot);
-        assert(position_ > 0);
-        correlation_ = static_cast<float>(top - bot) / static_cast<float>(position_);
+        // The last segment may be shorter; the file is truncated to its actual size once complete.
+        const auto reserve = static_cast<off_t>(std::uint64_t(header.count) * header.segment_size);
+        if (::posix_fallocate(file.fd, 0, reserve) != 0)
+        {
+            (void)::ftruncate(file.fd, reserve);
+        }
+        std::printf("PRN %u: receiving file %08x of %u segments into %s\n",
+                    prn_, static_cast<unsigned>(file.id), static_cast<unsigned>(header.count), name);
+        files_.push_back(std::move(file));
+        return files_.back();
     }
 
-    const std::vector<bool> spread_code_;
-    std::uint32_t position_;
-    std::uint32_t match_hi_ = 0;
-    std::uint32_t match_lo_ = 0;
-    float correlation_ = 0.0F;
-    bool state_ = false;
-};
-
-class Correlator
-{
-    static constexpr auto SequenceLength = side_channel::params::CDMACodeLength * OversamplingFactor;
-
-public:
-    /// The clock is recovered from the spread code along with the data.
-    /// Positive values represent truth, negative values represent falsity.
-    struct Result
-    {
-        float data  = 0.0F;
-        float clock = 0.0F;  ///< active high
-    };
-
-    Correlator()
+    void complete(File& file)
     {
-        using side_channel::params::CDMACode;
-        // Create the spread code sequence where each bit is expanded by the oversampling factor.
-        std::vector<bool> seq;
-        for (auto i = 0U; i < CDMACode.size(); i++)
+        if (::ftruncate(file.fd, static_cast<off_t>(file.size)) != 0)
         {
-            for (auto j = 0U; j < OversamplingFactor; j++)
-            {
-                seq.push_back(CDMACode[i]);
-            }
+            std::printf("PRN %u: could not truncate file %s\n", prn_, file.name.c_str());
         }
-        // Create the array of correlators where each item is offset by the sampling period.
-        for (std::uint32_t i = 0; i < SequenceLength; i++)
+        (void)::close(file.fd);
+        std::printf("\033[91m"
+                    "PRN %u: received file of %llu bytes saved into %s\n"
+                    "\033[m",
+                    prn_, static_cast<unsigned long long>(file.size), file.name.c_str());
+        const auto id = file.id;
+        completed_.emplace_back(id, static_cast<std::uint32_t>(file.received.size()));
+        if (completed_.size() > MaxCompletedFiles)
         {
-            channels_.emplace_back(seq, i);
+            completed_.pop_front();
         }
+        files_.erase(std::remove_if(std::begin(files_), std::end(files_), [id](const File& f) { return f.id == id; }),
+                     std::end(files_));
     }
 
-    Result feed(const bool sample)
-    {
-        float data = 0.0F;
-        float clock = 0.0F;
-        for (auto& a : channels_)
-        {
-            const auto res = a.feed(sample);
-            // Nonlinear weighting helps suppress noise from uncorrelated channels.
-            const float weight = std::pow(res.correlation, 4.0F);
-            data  += res.data  ? weight : -weight;
-            clock += res.clock ? weight : -weight;
-        }
-        return {
-            data,
-            clock
-        };
-    }
+    const unsigned prn_;
+    std::mutex mutex_;
+    std::deque<File> files_;
+    Completed completed_;
+};
 
-    /// Correlation factor per each correlator.
-    std::vector<float> getCorrelationVector() const
+/// Stores the standalone packet into a new file.
+static void savePacket(const std::vector<std::uint8_t>& packet, const unsigned prn)
+{
+    std::ostringstream file_name;
+    file_name << std::chrono::system_clock::now().time_since_epoch().count() << "_prn" << prn << ".bin";
+    if (std::ofstream out_file(file_name.str(), std::ios::binary | std::ios::out); out_file)
     {
-        std::vector<float> out;
-        std::transform(std::begin(channels_),
-                       std::end(channels_),
-                       std::back_insert_iterator(out),
-                       [](const CorrelationChannel& x) { return x.getCorrelation(); });
-        return out;
+        out_file.write(reinterpret_cast<const char*>(packet.data()), packet.size());
+        out_file.close();
     }
-
-    /// Performs a simple heuristic assessment of the code phase lock. This is unreliable though.
-    bool isCodePhaseSynchronized(const float stdev_multiple_threshold = 5.0F) const
+    else
     {
-        const auto cvec = getCorrelationVector();
-        const auto [mean, stdev] = computeMeanStdev(cvec);
-        const auto max = *std::max_element(std::begin(cvec), std::end(cvec));
-        return (max - mean) > (stdev * stdev_multiple_threshold);
+        std::printf("Could not open file %s\n", file_name.str().c_str());
+        std::exit(1);
     }
+    std::printf("\033[91m"
+                "PRN %u: received valid packet of %u bytes saved into file %s\n"
+                "\033[m",
+                prn, static_cast<unsigned>(packet.size()), file_name.str().c_str());
+}
 
-private:
-    std::vector<CorrelationChannel> channels_;
-};
-
-/// Reads data from the channel bit-by-bit. May read garbage if there is no carrier.
-class BitReader
+/// Receives packets from one lane of a link forever, or until the sampler daemon stops if attached to it.
+/// The segments are passed to the segment assembler of the link, which is shared by all of its lanes.
+static void receive(side_channel::rx::PacketReader& reader, const unsigned prn, SegmentAssembler& segments)
 {
-public:
-    /// Blocks until the next bit is received.
-    bool next()
+    try
     {
-        for (;;)
+        while (true)
         {
-            const bool phy_state = readPHY();
-            const auto result = correlator_.feed(phy_state);
-
-            if (!clock_latch_ && result.clock > 0.0F)
+            const auto frame = reader.next();
+            if (frame.type == side_channel::params::FrameType::Segment)
             {
-                clock_latch_ = true;
-                return result.data > 0.0F;
+                segments.add(frame.payload);
             }
-
-            if (clock_latch_ && result.clock < 0.0F)
+            else if (frame.type == side_channel::params::FrameType::Data)
             {
-                clock_latch_ = false;
+                savePacket(frame.payload, prn);
             }
         }
     }
-
-    void printDiagnostics()
+    catch (const std::runtime_error& ex)
     {
-        const auto cvec = correlator_.getCorrelationVector();
-        const auto [mean, stdev] = computeMeanStdev(cvec);
-        std::printf("mean=%.2f max=%.2f stdev=%.2f lock=%d | ",
-                    mean,
-                    *std::max_element(std::begin(cvec), std::end(cvec)),
-                    stdev,
-                    correlator_.isCodePhaseSynchronized());
-        for (auto c : cvec)
-        {
-            if (c > 0.2F)  // Do not print the status of poorly correlated channels to reduce visual noise.
-            {
-                std::printf("%X", int(c * 16.0F));
-            }
-            else
-            {
-                std::printf(".");
-            }
-        }
-        std::printf("\n");
-        fflush(stdout);
+        std::printf("PRN %u: %s\n", prn, ex.what());
     }
+}
 
-private:
-    Correlator correlator_;
-    bool clock_latch_ = false;
-};
-
-/// Reads symbols from the channel.
-/// Each frame is delimited by the frame delimiter on each side. The delimiter is 9 consecutive zero bits.
-/// Each byte within the frame is preceded by a single high start bit (which differentiates it from the delimiter).
-class SymbolReader
+/// Receives the link in the half-duplex ARQ mode forever (see side_channel_arq.hpp): the PHY is sampled until a poll
+/// is received, then the acknowledgement is sent over the reverse channel using the robust profile, and so on.
+/// The metrics of the link and of the timers accumulate across the bursts although the reader, the sampler, and the
+/// driver are recreated for each one.
+static void receiveARQ(const unsigned                     prn,
+                       const unsigned                     ack_prn,
+                       SegmentAssembler&                  segments,
+                       side_channel::trace::Writer* const trace,
+                       side_channel::telemetry::Registry& telemetry,
+                       const bool                         verbose)
 {
-public:
-    struct Delimiter {};
-    using Symbol = std::variant<Delimiter, std::uint8_t>;
-
-    Symbol next()
+    using side_channel::params::FrameType;
+    const auto cores = side_channel::lanes::getLaneCores(0, 1);
+    auto& metrics = telemetry.add("prn" + std::to_string(prn));
+    auto& sampler_timing = telemetry.addTimer("sampler");
+    auto& driver_timing = telemetry.addTimer("ack");
+    for (;;)
     {
-        while (true)
+        std::optional<std::uint32_t> file_id;
         {
-            const bool bit = bit_reader_.next();
-            std::printf("bit %d\n", bit);
-            bit_reader_.printDiagnostics();
-            if (remaining_bits_ >= 0)
+            side_channel::rx::Sampler sampler({cores}, trace, &sampler_timing);
+            side_channel::rx::PacketReader reader(sampler.getPort(0), prn, "prn" + std::to_string(prn));
+            reader.setDiagnosticsEnabled(verbose);
+            reader.setTelemetry(&metrics);
+            while (!file_id)
             {
-                buffer_ = (buffer_ << 1U) | bit;
-                remaining_bits_--;
-                if (remaining_bits_ < 0)
+                const auto frame = reader.next();
+                if (frame.type == FrameType::Poll)
                 {
-                    return Symbol{buffer_};
+                    file_id = side_channel::arq::parsePoll(frame.payload);
                 }
-            }
-            else if (bit)  // Detect start bit.
-            {
-                consecutive_zeros_ = 0;
-                remaining_bits_ = 7;
-                buffer_ = 0;
-            }
-            else  // Detect frame delimiter.
-            {
-                consecutive_zeros_++;
-                if (consecutive_zeros_ > 8)
+                else if (frame.type == FrameType::Segment)
+                {
+                    segments.add(frame.payload);
+                }
+                else if (frame.type == FrameType::Data)
                 {
-                    remaining_bits_ = -1;
-                    return Symbol{Delimiter{}};
+                    savePacket(frame.payload, prn);
                 }
             }
         }
+        std::this_thread::sleep_for(side_channel::arq::getTurnaroundDelay());
+        const auto ack = segments.getAck(*file_id);
+        std::printf("PRN %u: file %08x: acknowledging %u segments received in order\n",
+                    prn, static_cast<unsigned>(ack.file_id), static_cast<unsigned>(ack.base));
+        fflush(stdout);
+        side_channel::tx::PHYDriver driver(cores);
+        driver.setTelemetry(&driver_timing);
+        side_channel::tx::emitBurst<side_channel::params::RobustProfile>(
+            driver,
+            ack_prn,
+            {side_channel::tx::makeFrame(FrameType::Ack,
+                                         side_channel::arq::makeAck(ack),
+                                         side_channel::crc::Kind::CRC16CCITT,
+                                         side_channel::arq::AckFEC)},
+            side_channel::arq::AckFEC,
+            side_channel::params::PreambleLength);
     }
+}
 
-private:
-    BitReader bit_reader_;
-
-    std::uint64_t consecutive_zeros_ = 0;
-    std::uint8_t  buffer_ = 0;
-    std::int8_t   remaining_bits_ = -1;
-};
-
-/// Reads full data packets from the channel.
-/// Packets are delimited using the delimiter symbol and contain CRC-16-CCITT at the end (big endian; residue zero).
-class PacketReader
+/// Multiple links with distinct spread codes (PRN numbers) can be received at once from the same sample stream;
+/// each link is decoded by its own correlator bank in its own thread. The sample stream is either produced by the
+/// own sampler or, if attached, by the sampler daemon of the host (see sampler.cpp), which is shared by all receivers.
+/// If there are several lanes, each lane of each link is decoded separately using the PRN number of the link plus
+/// the lane index.
+/// The metrics of each lane and the timing of the sampler are published into the telemetry file and/or printed
+/// periodically if requested; the diagnostics of every bit are printed only in the verbose mode because they slow
+/// down the decoding.
+int main(const int argc, const char* const argv[])
 {
-    template <class Visitor, class... Variants>
-    friend constexpr auto visit( Visitor&& vis, Variants&&... vars );
-
-public:
-    std::vector<std::uint8_t> next()
+    std::vector<unsigned> prns;
+    unsigned lane_count = 1;
+    bool arq = false;
+    std::optional<unsigned> ack_prn;
+    std::string trace_path;
+    std::string attach_name;
+    std::string telemetry_path;
+    bool monitor = false;
+    bool verbose = false;
+    side_channel::ExecutionProfile execution;
+    for (auto i = 1; i < argc; i++)
     {
-        while (true)
+        const std::string arg(argv[i]);
+        if (arg.rfind("--prn=", 0) == 0)
         {
-            const auto sym = symbol_reader_.next();
-            if (const auto ret = std::visit(assembler_, sym))
-            {
-                return *ret;
-            }
+            prns.push_back(static_cast<unsigned>(std::stoul(arg.substr(6))));
+        }
+        else if (arg.rfind("--lanes=", 0) == 0)
+        {
+            lane_count = static_cast<unsigned>(std::stoul(arg.substr(8)));
+        }
+        else if (arg == "--arq")
+        {
+            arq = true;
+        }
+        else if (arg.rfind("--ack-prn=", 0) == 0)
+        {
+            ack_prn = static_cast<unsigned>(std::stoul(arg.substr(10)));
+        }
+        else if (arg.rfind("--trace=", 0) == 0)
+        {
+            trace_path = arg.substr(8);
+        }
+        else if (arg.rfind("--attach=", 0) == 0)
+        {
+            attach_name = arg.substr(9);
+        }
+        else if (arg.rfind("--telemetry=", 0) == 0)
+        {
+            telemetry_path = arg.substr(12);
+        }
+        else if (arg == "--monitor")
+        {
+            monitor = true;
+        }
+        else if (arg == "--verbose")
+        {
+            verbose = true;
+        }
+        else if (side_channel::parseExecutionOption(arg, execution))
+        {
+            // Applied after all options are parsed.
+        }
+        else
+        {
+            lane_count = 0;
+            break;
         }
     }
-
-private:
-    class FrameAssembler
+    // The execution profile is applied first because it defines the cores available to the PHY.
+    for (const auto& warning : side_channel::applyExecutionProfile(execution))
+    {
+        std::cerr << "WARNING: " << warning << std::endl;
+    }
+    if (prns.empty())
     {
-    public:
-        std::optional<std::vector<std::uint8_t>> operator()(const SymbolReader::Delimiter&)
+        prns.push_back(1);
+    }
+    // If attached, the lanes are made of the PHY cores of the daemon rather than those of this process.
+    unsigned core_count = side_channel::getThreadCount();
+    if (!attach_name.empty() && !arq && trace_path.empty())
+    {
+        core_count = side_channel::shm::Reader(attach_name).getCoreCount();
+    }
+    if ((lane_count == 0U) || (lane_count > core_count) ||
+        (arq && ((lane_count != 1U) || (prns.size() != 1U) || (ack_prn.value_or(prns.front() + 1U) == prns.front()))) ||
+        (!attach_name.empty() && (arq || !trace_path.empty())))
+    {
+        std::cerr << "Usage:\n\t" << argv[0] << " [--prn=N]... [--lanes=1.." << core_count << "]"
+                  << " [OPTIONS]\n\t" << argv[0] << " --arq [--prn=N] [--ack-prn=N] [OPTIONS]\n"
+                  << "Options: [--trace=FILE | --attach=/NAME] [--telemetry=FILE] [--monitor] [--verbose]\n\t"
+                  << side_channel::ExecutionOptionUsage << "\n"
+                  << "The ARQ mode receives one link of one lane; the acknowledgements are sent using PRN+1 by default."
+                  << "\nThe trace of the raw PHY measurements can be replayed offline using the replay tool."
+                  << "\nIf attached, the PHY is sampled by the sampler daemon publishing into the named shared memory"
+                  << "\nobject (" << side_channel::shm::DefaultName << " by default); the ARQ mode cannot be attached."
+                  << "\nThe telemetry file is updated every second; --monitor prints the same metrics."
+                  << "\nThe verbose mode prints the diagnostics of every bit, which slows down the decoding."
+                  << std::endl;
+        return 1;
+    }
+    for (auto id = 0U; id < std::variant_size_v<side_channel::params::Profile>; id++)
+    {
+        std::visit([](auto p)
         {
-            //std::puts("frame delimiter");
-            std::optional<std::vector<std::uint8_t>> result;
-            if (buffer_.size() >= 2)
-            {
-                std::uint16_t crc = side_channel::CRCInitial;
-                for (std::uint8_t v : buffer_)
-                {
-                    crc = side_channel::crcAdd(crc, v);
-                }
-                if (0 == crc)
-                {
-                    buffer_.pop_back();  // Drop the CRC from the end.
-                    buffer_.pop_back();
-                    result.emplace(buffer_);
-                }
-                else
-                {
-                    std::puts("crc error");
-                }
-            }
-            buffer_.clear();
-            return result;
+            using P = decltype(p);
+            std::cout << "LINK PROFILE:       " << P::Name << ": " << P::CodeLength << " bit code, "
+                      << P::ChipPeriod.count() * 1e-6 << " ms chip" << std::endl;
+        }, *side_channel::params::findProfile(static_cast<std::uint8_t>(id)));
+    }
+    std::cout << "CLOCK SOURCE:       " << side_channel::FastClock::getSourceName() << std::endl;
+    std::cout << "PHY BACKEND:        " << side_channel::backend::Default::Name << std::endl;
+    std::cout << "CPU TOPOLOGY:       " << side_channel::topology::describe(side_channel::topology::getTopology())
+              << std::endl;
+    std::cout << "EXECUTION PROFILE:  " << side_channel::describeExecutionProfile(side_channel::getExecutionProfile())
+              << std::endl;
+    std::vector<std::vector<unsigned>> port_cores;
+    for (auto prn : prns)
+    {
+        // Fail early if the PRN number of any lane is invalid.
+        (void) side_channel::params::RobustProfile::getCode(prn + lane_count - 1U);
+        std::cout << "RECEIVING PRN:      " << prn << std::endl;
+        for (auto lane = 0U; lane < lane_count; lane++)
+        {
+            port_cores.push_back(side_channel::lanes::getLaneCores(lane, lane_count, core_count));
         }
-
-        std::optional<std::vector<std::uint8_t>> operator()(const std::uint8_t data)
+    }
+    if (!attach_name.empty())
+    {
+        std::cout << "ATTACHED TO:        " << attach_name << ", " << core_count << " PHY cores" << std::endl;
+    }
+    for (auto lane = 0U; (lane < lane_count) && (lane_count > 1U) && attach_name.empty(); lane++)
+    {
+        std::cout << "LANE " << lane << " CPUS:";
+        for (auto core : side_channel::lanes::getLaneCores(lane, lane_count))
         {
-            //std::printf("byte 0x%02x\n", data);
-            buffer_.push_back(data);
-            return {};
+            std::cout << " " << side_channel::getCPU(core);
         }
-
-    private:
-        std::vector<std::uint8_t> buffer_;
-    };
-
-    SymbolReader symbol_reader_;
-    FrameAssembler assembler_;
-};
-
-int main()
-{
-    std::cout << "SPREAD CODE LENGTH: " << side_channel::params::CDMACodeLength << " bit" << std::endl;
-    std::cout << "SPREAD CHIP PERIOD: " << side_channel::params::ChipPeriod.count() * 1e-6 << " ms" << std::endl;
-    side_channel::initThread();
-    PacketReader reader;
-    while (true)
+        std::cout << std::endl;
+    }
+    std::unique_ptr<side_channel::trace::Writer> trace;
+    if (!trace_path.empty())
     {
-        const auto packet = reader.next();
-
-        std::ostringstream file_name;
-        file_name << std::chrono::system_clock::now().time_since_epoch().count() << ".bin";
-        if (std::ofstream out_file(file_name.str(), std::ios::binary | std::ios::out); out_file)
+        trace = std::make_unique<side_channel::trace::Writer>(
+            trace_path,
+            side_channel::getThreadCount(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(side_channel::rx::SampleDuration));
+        std::cout << "RECORDING TRACE:    " << trace_path << std::endl;
+    }
+    side_channel::telemetry::Registry telemetry;
+    std::unique_ptr<side_channel::telemetry::Publisher> publisher;
+    if (!telemetry_path.empty() || monitor)
+    {
+        publisher = std::make_unique<side_channel::telemetry::Publisher>(telemetry, telemetry_path, monitor);
+        if (!telemetry_path.empty())
         {
-            out_file.write(reinterpret_cast<const char*>(packet.data()), packet.size());
-            out_file.close();
+            std::cout << "TELEMETRY:          " << telemetry_path << std::endl;
         }
-        else
+    }
+    if (arq)
+    {
+        ack_prn = ack_prn.value_or(prns.front() + 1U);
+        (void) side_channel::params::RobustProfile::getCode(*ack_prn);
+        std::cout << "ACK PRN:            " << *ack_prn << std::endl;
+        SegmentAssembler segments(prns.front());
+        receiveARQ(prns.front(),
+                   *ack_prn,
+                   segments,
+                   trace.get(),
+                   telemetry,
+                   verbose);
+        return 0;
+    }
+    // The thread affinity is configured by the sampler thread; the decoders are free to run on any other core.
+    std::unique_ptr<side_channel::rx::Sampler> sampler;
+    std::vector<std::unique_ptr<side_channel::rx::PHYSource>> sources;
+    if (attach_name.empty())
+    {
+        sampler = std::make_unique<side_channel::rx::Sampler>(port_cores, trace.get(), &telemetry.addTimer("sampler"));
+    }
+    else
+    {
+        for (const auto& cores : port_cores)
         {
-            std::printf("Could not open file %s\n", file_name.str().c_str());
-            return 1;
+            sources.push_back(std::make_unique<side_channel::rx::SharedSource>(attach_name, cores));
         }
-        std::printf("\033[91m"
-                    "received valid packet of %u bytes saved into file %s\n"
-                    "\033[m",
-                    static_cast<unsigned>(packet.size()), file_name.str().c_str());
+    }
+    const auto getSource = [&](const std::size_t index) -> side_channel::rx::PHYSource&
+    {
+        return sampler ? static_cast<side_channel::rx::PHYSource&>(sampler->getPort(index)) : *sources.at(index);
+    };
+    std::vector<std::unique_ptr<SegmentAssembler>> assemblers;
+    std::vector<std::unique_ptr<side_channel::rx::PacketReader>> readers;
+    std::vector<std::thread> workers;
+    for (auto i = 0U; i < prns.size(); i++)
+    {
+        const auto prn = prns.at(i);
+        assemblers.push_back(std::make_unique<SegmentAssembler>(prn));
+        for (auto lane = 0U; lane < lane_count; lane++)
+        {
+            const auto name = "prn" + std::to_string(prn + lane);
+            readers.push_back(std::make_unique<side_channel::rx::PacketReader>(getSource((i * lane_count) + lane),
+                                                                               prn + lane,
+                                                                               name));
+            readers.back()->setDiagnosticsEnabled(verbose);
+            readers.back()->setTelemetry(&telemetry.add(name));
+            workers.emplace_back(receive, std::ref(*readers.back()), prn, std::ref(*assemblers.back()));
+        }
+    }
+    for (auto& w : workers)
+    {
+        w.join();
     }
     return 0;
 }
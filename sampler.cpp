@@ -0,0 +1,116 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+/// g++ -std=c++17 -O2 -march=native -Wall sampler.cpp -lpthread -o sampler && ./sampler
+///
+/// The sampler daemon: samples the PHY on all cores of its execution profile and publishes the measurements into
+/// a shared memory ring (see side_channel_shm.hpp), from which any number of receivers decode their links
+/// (rx --attach). Only one process on the host shall sample the PHY, because the counter threads of one would
+/// disturb the measurements of another. The daemon runs until it is interrupted (SIGINT or SIGTERM).
+
+#include "side_channel_params.hpp"
+#include "side_channel_shm.hpp"
+#include "side_channel_rx.hpp"
+#include "side_channel_telemetry.hpp"
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <pthread.h>
+
+int main(const int argc, const char* const argv[])
+{
+    std::string name = side_channel::shm::DefaultName;
+    std::uint32_t capacity = side_channel::shm::DefaultCapacity;
+    std::string telemetry_path;
+    bool monitor = false;
+    bool valid = true;
+    side_channel::ExecutionProfile execution;
+    for (auto i = 1; i < argc; i++)
+    {
+        const std::string arg(argv[i]);
+        if (arg.rfind("--name=", 0) == 0)
+        {
+            name = arg.substr(7);
+        }
+        else if (arg.rfind("--capacity=", 0) == 0)
+        {
+            capacity = static_cast<std::uint32_t>(std::stoul(arg.substr(11)));
+        }
+        else if (arg.rfind("--telemetry=", 0) == 0)
+        {
+            telemetry_path = arg.substr(12);
+        }
+        else if (arg == "--monitor")
+        {
+            monitor = true;
+        }
+        else if (side_channel::parseExecutionOption(arg, execution))
+        {
+            // Applied after all options are parsed.
+        }
+        else
+        {
+            valid = false;
+            break;
+        }
+    }
+    if (!valid || name.empty() || (name.front() != '/') || (capacity == 0U) || ((capacity & (capacity - 1U)) != 0U))
+    {
+        std::cerr << "Usage:\n\t" << argv[0] << " [--name=/NAME] [--capacity=POWER_OF_TWO]"
+                  << " [--telemetry=FILE] [--monitor]\n\t\t" << side_channel::ExecutionOptionUsage << "\n"
+                  << "The measurements are published into the shared memory object " << side_channel::shm::DefaultName
+                  << " by default; the receivers attach to it using rx --attach=/NAME."
+                  << "\nThe capacity is the number of the measurements retained for the receivers that fall behind."
+                  << "\nThe telemetry file is updated every second; --monitor prints the same metrics."
+                  << std::endl;
+        return 1;
+    }
+    for (const auto& warning : side_channel::applyExecutionProfile(execution))
+    {
+        std::cerr << "WARNING: " << warning << std::endl;
+    }
+    std::cout << "CLOCK SOURCE:       " << side_channel::FastClock::getSourceName() << std::endl;
+    std::cout << "PHY BACKEND:        " << side_channel::backend::Default::Name << std::endl;
+    std::cout << "CPU TOPOLOGY:       " << side_channel::topology::describe(side_channel::topology::getTopology())
+              << std::endl;
+    std::cout << "EXECUTION PROFILE:  " << side_channel::describeExecutionProfile(side_channel::getExecutionProfile())
+              << std::endl;
+    std::cout << "PHY CPUS:          ";
+    for (auto core = 0U; core < side_channel::getThreadCount(); core++)
+    {
+        std::cout << " " << side_channel::getCPU(core);
+    }
+    std::cout << std::endl;
+
+    // The signals are blocked before any thread is started, so that they are delivered only to sigwait() below.
+    sigset_t signals{};
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    (void)pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    side_channel::shm::Writer writer(name,
+                                     side_channel::getThreadCount(),
+                                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         side_channel::rx::SampleDuration),
+                                     capacity);
+    std::cout << "PUBLISHING INTO:    " << writer.getName() << ", " << capacity << " measurements" << std::endl;
+    side_channel::telemetry::Registry telemetry;
+    std::unique_ptr<side_channel::telemetry::Publisher> publisher;
+    if (!telemetry_path.empty() || monitor)
+    {
+        publisher = std::make_unique<side_channel::telemetry::Publisher>(telemetry, telemetry_path, monitor);
+        if (!telemetry_path.empty())
+        {
+            std::cout << "TELEMETRY:          " << telemetry_path << std::endl;
+        }
+    }
+    {
+        side_channel::rx::Sampler sampler({}, nullptr, &telemetry.addTimer("sampler"), &writer);
+        int signal = 0;
+        (void)sigwait(&signals, &signal);
+        std::cout << "Stopping on signal " << signal << std::endl;
+    }
+    return 0;
+}
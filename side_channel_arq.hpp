@@ -0,0 +1,153 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Half-duplex selective repeat ARQ of the segmented file transfer (see side_channel_segment.hpp).
+/// The transmitter sends a window of the segments that are not yet acknowledged in one burst, and ends the burst
+/// with a poll frame (params::FrameType::Poll). The receiver responds to the poll with an acknowledgement frame
+/// (params::FrameType::Ack) over the reverse channel, which uses a different spread code and the robust profile.
+/// The acknowledgement is a bitmap of the received segments of the window, so the transmitter resends only
+/// the missing ones. Each side samples the PHY only while the other side is transmitting; the loads of the two
+/// sides would otherwise interfere because they share the same cores.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_crc.hpp"
+#include "side_channel_fec.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace side_channel::arq
+{
+
+/// The number of segments covered by one acknowledgement, starting from the first missing one.
+/// The transmitter shall not send segments past the window before the first missing segment is acknowledged.
+static constexpr std::uint32_t WindowSize = 32;
+
+/// The transmitter gives up after this many consecutive polls without an acknowledgement.
+static constexpr unsigned MaxRetries = 8;
+
+/// The acknowledgements are always protected by the FEC because they are short, and a lost acknowledgement costs
+/// the retransmission of the whole window.
+static constexpr auto AckFEC = fec::Kind::Convolutional;
+
+/// The transmitter waits for the acknowledgement this many times longer than it takes to transmit.
+static constexpr auto AckTimeoutMargin = 2;
+
+/// The poll payload is the file ID (big endian).
+static constexpr std::size_t PollSize = 4;
+
+/// All fields are big endian. All segments before the base are received; bit K of the bitmap (MSB first)
+/// is set if segment base+K is received. The base equals the segment count once the file is complete.
+struct Ack
+{
+    static constexpr std::size_t Size = 8 + (WindowSize / 8U);
+
+    std::uint32_t file_id = 0;
+    std::uint32_t base = 0;
+    std::array<std::uint8_t, WindowSize / 8U> bitmap{};
+
+    bool isReceived(const std::uint32_t index) const
+    {
+        if (index < base)
+        {
+            return true;
+        }
+        const auto offset = index - base;
+        return (offset < WindowSize) && (((bitmap[offset / 8U] >> (7U - (offset % 8U))) & 1U) != 0U);
+    }
+
+    void setReceived(const std::uint32_t index)
+    {
+        if ((index >= base) && ((index - base) < WindowSize))
+        {
+            bitmap[(index - base) / 8U] |= static_cast<std::uint8_t>(0x80U >> ((index - base) % 8U));
+        }
+    }
+};
+
+namespace detail
+{
+
+inline void put32(std::vector<std::uint8_t>& out, const std::uint32_t value)
+{
+    for (auto i = 4U; i --> 0U;)
+    {
+        out.push_back(static_cast<std::uint8_t>(value >> (i * 8U)));
+    }
+}
+
+inline std::uint32_t get32(const std::vector<std::uint8_t>& in, const std::size_t offset)
+{
+    std::uint32_t out = 0;
+    for (auto i = 0U; i < 4U; i++)
+    {
+        out = (out << 8U) | in[offset + i];
+    }
+    return out;
+}
+
+}
+
+inline std::vector<std::uint8_t> makePoll(const std::uint32_t file_id)
+{
+    std::vector<std::uint8_t> out;
+    detail::put32(out, file_id);
+    return out;
+}
+
+/// Returns the file ID; empty if the payload is malformed.
+inline std::optional<std::uint32_t> parsePoll(const std::vector<std::uint8_t>& payload)
+{
+    if (payload.size() != PollSize)
+    {
+        return {};
+    }
+    return detail::get32(payload, 0);
+}
+
+inline std::vector<std::uint8_t> makeAck(const Ack& ack)
+{
+    std::vector<std::uint8_t> out;
+    out.reserve(Ack::Size);
+    detail::put32(out, ack.file_id);
+    detail::put32(out, ack.base);
+    out.insert(std::end(out), std::begin(ack.bitmap), std::end(ack.bitmap));
+    return out;
+}
+
+/// Empty if the payload is malformed.
+inline std::optional<Ack> parseAck(const std::vector<std::uint8_t>& payload)
+{
+    if (payload.size() != Ack::Size)
+    {
+        return {};
+    }
+    Ack out;
+    out.file_id = detail::get32(payload, 0);
+    out.base = detail::get32(payload, 4);
+    std::copy(std::begin(payload) + 8, std::end(payload), std::begin(out.bitmap));
+    return out;
+}
+
+/// Each side waits for the postamble of the other side to end before it transmits, so that the sides do not transmit
+/// at the same time. The postamble is measured in the robust profile because the poll may be sent using any profile.
+inline std::chrono::nanoseconds getTurnaroundDelay()
+{
+    return params::RobustProfile::SymbolPeriod * params::PostambleLength;
+}
+
+/// How long the transmitter waits for the acknowledgement after the end of its burst.
+inline std::chrono::nanoseconds getAckTimeout(const std::uint32_t preamble_length)
+{
+    const auto body_size = fec::getEncodedSize(AckFEC, Ack::Size + crc::CRC16CCITT::Size);
+    return (getTurnaroundDelay() + params::RobustProfile::getFrameDuration(body_size, preamble_length)) *
+           AckTimeoutMargin;
+}
+
+}
@@ -0,0 +1,220 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The backends of the PHY: the shared resource whose contention carries the signal. The transmitter modulates it
+/// by running the load of the backend while the PHY is driven high (see tx::BasicPHYDriver), and the receiver
+/// measures the rate of the probe of the backend in every sampling window (see rx::readPHY()). The rate of the probe
+/// drops while the PHY is driven high, which is all that the layers above assume, so the front end, the correlator,
+/// and the framing do not depend on the backend.
+///
+/// A backend is a type with the following members:
+///     static constexpr const char* Name;
+///     class Load;     One per load thread. operator()() runs a short burst of the modulating activity; it is invoked
+///                     repeatedly for as long as the level is high, so it shall return within microseconds.
+///     class Probe;    One per counter thread. begin() is invoked at the beginning of every sampling window, and
+///                     operator()() runs a short burst of the measured activity and returns the number of the units
+///                     of work done, which are summed over the window.
+/// Both are default-constructible; they are constructed in the thread that uses them.
+///
+/// The backend is selected at build time (see PHY_BACKEND below); the transmitter and the receiver shall agree.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_timer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PHY_BACKEND_CPU_LOAD            0
+#define PHY_BACKEND_MEMORY_BANDWIDTH    1
+#define PHY_BACKEND_LOOPBACK            2
+
+/// The backend of the PHY used by the tools, e.g., -DPHY_BACKEND=PHY_BACKEND_MEMORY_BANDWIDTH.
+#ifndef PHY_BACKEND
+#   define PHY_BACKEND PHY_BACKEND_CPU_LOAD
+#endif
+
+namespace side_channel::backend
+{
+
+/// The load of the CPU cores: the original PHY. The probe counts the iterations of the sampling loop, which is slowed
+/// down by the load of the transmitter on the same cores or on the sibling hyperthreads.
+struct CPULoad
+{
+    static constexpr const char* Name = "cpu";
+
+    class Load
+    {
+    public:
+        void operator()() const
+        {
+            volatile std::uint8_t i = 1;
+            while (i != 0)
+            {
+                i = i + 1U;
+            }
+        }
+    };
+
+    class Probe
+    {
+    public:
+        void begin() const { }
+        std::int64_t operator()() const { return 1; }
+    };
+};
+
+/// The contention for the memory bandwidth. The load streams stores through a buffer much larger than the last-level
+/// cache, which saturates the memory controller, and the probe streams loads through another one, counting the cache
+/// lines read. This couples the hosts that share the memory controller but not the cores, e.g., the virtual machines
+/// pinned to different cores of one socket. Each load and probe has its own buffer.
+struct MemoryBandwidth
+{
+    static constexpr const char* Name = "memory";
+
+    /// Much larger than the last-level cache of the common processors, so that the accesses reach the memory.
+    static constexpr std::size_t BufferSize = 64U * 1024U * 1024U;
+    static constexpr std::size_t CacheLineSize = 64;
+    /// The amount of memory accessed per burst; small enough to react to the chip edges quickly.
+    static constexpr std::size_t BurstSize = 16U * 1024U;
+
+    class Load
+    {
+    public:
+        Load() : buffer_(BufferSize, 0) { }
+
+        void operator()()
+        {
+            std::memset(buffer_.data() + offset_, static_cast<int>(offset_ / BurstSize), BurstSize);
+            offset_ = (offset_ + BurstSize) % BufferSize;
+        }
+
+    private:
+        std::vector<std::uint8_t> buffer_;
+        std::size_t offset_ = 0;
+    };
+
+    class Probe
+    {
+    public:
+        /// The buffer is written once so that its pages are backed by memory rather than by the shared zero page.
+        Probe() : buffer_(BufferSize, 1) { }
+
+        void begin() const { }
+
+        std::int64_t operator()()
+        {
+            std::uint64_t sum = 0;
+            for (std::size_t i = 0; i < BurstSize; i += CacheLineSize)
+            {
+                sum += buffer_[offset_ + i];
+            }
+            sink_ = sink_ + sum;
+            offset_ = (offset_ + BurstSize) % BufferSize;
+            return static_cast<std::int64_t>(BurstSize / CacheLineSize);
+        }
+
+    private:
+        std::vector<std::uint8_t> buffer_;
+        std::size_t offset_ = 0;
+        volatile std::uint64_t sink_ = 0;  ///< Keeps the loads from being optimized out.
+    };
+};
+
+/// A noiseless loopback for testing the whole stack on one host, including the live timing, independently of the
+/// contention: the load stamps the time into a word shared by all processes of the host, and the probe weighs
+/// the elapsed time by the level, which is high if the stamp is recent. The tick rate seen by the receiver is
+/// therefore deterministic, and it is halved while the PHY is driven high. Unlike the contention, the stamp is not
+/// refreshed while the load is preempted, so the transmitter and the receiver shall run on different CPUs.
+struct Loopback
+{
+    static constexpr const char* Name = "loopback";
+
+    /// The name of the shared memory object holding the stamp.
+    static constexpr const char* SharedName = "/side_channel_loopback";
+    /// The level is high if the load has run within this interval; much shorter than a chip.
+    static constexpr std::chrono::microseconds HoldTime{50};
+
+    /// Throws std::runtime_error if the shared word cannot be mapped.
+    static std::atomic<std::int64_t>& getStamp()
+    {
+        static std::atomic<std::int64_t>* const stamp = []()
+        {
+            static_assert(std::atomic<std::int64_t>::is_always_lock_free);
+            const int fd = ::shm_open(SharedName, O_RDWR | O_CREAT, 0666);
+            void* data = MAP_FAILED;
+            if ((fd >= 0) && (::ftruncate(fd, sizeof(std::atomic<std::int64_t>)) == 0))
+            {
+                data = ::mmap(nullptr, sizeof(std::atomic<std::int64_t>), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (fd >= 0)
+            {
+                (void)::close(fd);
+            }
+            if (data == MAP_FAILED)
+            {
+                throw std::runtime_error(std::string("Cannot map the loopback PHY ") + SharedName);
+            }
+            return static_cast<std::atomic<std::int64_t>*>(data);   // The zero-filled memory is a valid atomic.
+        }();
+        return *stamp;
+    }
+
+    class Load
+    {
+    public:
+        void operator()() const
+        {
+            stamp_.store(side_channel::FastClock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            side_channel::timer::relax();
+        }
+
+    private:
+        std::atomic<std::int64_t>& stamp_ = getStamp();
+    };
+
+    class Probe
+    {
+    public:
+        void begin() { last_ = side_channel::FastClock::now().time_since_epoch().count(); }
+
+        /// One unit per nanosecond while the level is low, and one per two nanoseconds while it is high.
+        std::int64_t operator()()
+        {
+            side_channel::timer::relax();
+            const auto now = side_channel::FastClock::now().time_since_epoch().count();
+            const auto elapsed = std::max<std::int64_t>(0, now - last_);
+            last_ = now;
+            const bool high = (now - stamp_.load(std::memory_order_relaxed)) < HoldTimeNs;
+            return high ? (elapsed / 2) : elapsed;
+        }
+
+    private:
+        static constexpr std::int64_t HoldTimeNs = std::chrono::nanoseconds(HoldTime).count();
+
+        std::atomic<std::int64_t>& stamp_ = getStamp();
+        std::int64_t last_ = 0;
+    };
+};
+
+#if PHY_BACKEND == PHY_BACKEND_CPU_LOAD
+using Default = CPULoad;
+#elif PHY_BACKEND == PHY_BACKEND_MEMORY_BANDWIDTH
+using Default = MemoryBandwidth;
+#elif PHY_BACKEND == PHY_BACKEND_LOOPBACK
+using Default = Loopback;
+#else
+#   error "Unknown PHY_BACKEND"
+#endif
+
+}
@@ -0,0 +1,122 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// A pool of reusable byte buffers. The received packets are delivered in the buffers borrowed from the pool
+/// (see rx::Packet), so that once the pool is warm, no memory is allocated per packet: a buffer retains its capacity
+/// when it is returned to the pool, and the largest packets seen so far fit into it without reallocation.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace side_channel::buffer
+{
+
+/// The buffers that are not in use are retained up to this number; the excess ones are freed.
+static constexpr std::size_t DefaultMaxFreeCount = 16;
+
+namespace detail
+{
+struct PoolState
+{
+    /// The free list is reserved in advance, so returning a buffer does not allocate.
+    explicit PoolState(const std::size_t max_free_count) : max_free(max_free_count) { free.reserve(max_free); }
+
+    std::mutex mutex;
+    std::vector<std::vector<std::uint8_t>> free;
+    const std::size_t max_free;
+};
+}
+
+/// A byte buffer borrowed from a pool; it is returned to the pool when destroyed. Move-only.
+/// The buffer may outlive its pool, in which case it is simply freed.
+class Buffer
+{
+public:
+    Buffer() = default;
+    ~Buffer() { release(); }
+
+    Buffer(Buffer&&) noexcept = default;
+    Buffer& operator=(Buffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            state_ = std::move(other.state_);
+            bytes_ = std::move(other.bytes_);
+        }
+        return *this;
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    std::vector<std::uint8_t>&       getBytes()       { return bytes_; }
+    const std::vector<std::uint8_t>& getBytes() const { return bytes_; }
+
+private:
+    friend class Pool;
+
+    Buffer(std::shared_ptr<detail::PoolState> state, std::vector<std::uint8_t> bytes) :
+        state_(std::move(state)),
+        bytes_(std::move(bytes))
+    { }
+
+    void release() noexcept
+    {
+        if (state_)
+        {
+            bytes_.clear();
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            if (state_->free.size() < state_->max_free)
+            {
+                state_->free.push_back(std::move(bytes_));
+            }
+            state_.reset();
+        }
+    }
+
+    std::shared_ptr<detail::PoolState> state_;
+    std::vector<std::uint8_t> bytes_;
+};
+
+/// Thread-safe; the buffers may be returned from any thread. A copy of the pool shares the buffers of the original.
+class Pool
+{
+public:
+    explicit Pool(const std::size_t max_free_count = DefaultMaxFreeCount) :
+        state_(std::make_shared<detail::PoolState>(max_free_count))
+    { }
+
+    /// The buffer is empty; its capacity is that of the last use if it is reused.
+    Buffer acquire()
+    {
+        std::vector<std::uint8_t> bytes;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            if (!state_->free.empty())
+            {
+                bytes = std::move(state_->free.back());
+                state_->free.pop_back();
+            }
+        }
+        return Buffer(state_, std::move(bytes));
+    }
+
+    /// The number of the buffers that are ready for reuse.
+    std::size_t getFreeCount() const
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->free.size();
+    }
+
+private:
+    std::shared_ptr<detail::PoolState> state_;
+};
+
+}
@@ -0,0 +1,216 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Compile-time generators of pseudorandom CDMA spread codes: maximum length sequences (m-sequences) and Gold codes.
+/// The codes are generated by linear feedback shift registers during compilation and stored as packed bit tables,
+/// so the code length is a compile-time constant that the correlator and the transmitter are specialized on.
+/// Helpful resource: https://natronics.github.io/blag/2014/gps-prn/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace side_channel::code
+{
+
+/// A spread code of the specified length in chips packed into 64-bit words. Chip K is bit K%64 of word K/64.
+template <std::uint32_t Length_>
+class SpreadCode
+{
+public:
+    static constexpr std::uint32_t Length    = Length_;
+    static constexpr std::uint32_t WordBits  = 64;
+    static constexpr std::uint32_t WordCount = (Length + WordBits - 1U) / WordBits;
+    using Words = std::array<std::uint64_t, WordCount>;
+
+    static constexpr std::uint32_t size() { return Length; }
+
+    constexpr bool operator[](const std::uint32_t index) const
+    {
+        return ((words_[index / WordBits] >> (index % WordBits)) & 1U) != 0;
+    }
+
+    constexpr void set(const std::uint32_t index, const bool value)
+    {
+        const auto mask = 1ULL << (index % WordBits);
+        words_[index / WordBits] = value ? (words_[index / WordBits] | mask) : (words_[index / WordBits] & ~mask);
+    }
+
+    /// The bits past the end of the code in the last word are zero.
+    constexpr const Words& getWords() const { return words_; }
+
+    constexpr bool operator==(const SpreadCode& other) const
+    {
+        for (auto i = 0U; i < WordCount; i++)
+        {
+            if (words_[i] != other.words_[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    constexpr bool operator!=(const SpreadCode& other) const { return !(*this == other); }
+
+private:
+    Words words_{};
+};
+
+/// Generates the m-sequence of the linear feedback shift register with the specified number of stages.
+/// The taps are the exponents of the characteristic polynomial (excluding the constant term) as a bit mask where
+/// bit K-1 represents the term x^K; e.g., x^10+x^3+1 is ((1<<9)|(1<<2)). The polynomial shall be primitive for
+/// the output to be an m-sequence. The register is initialized with all ones and the output is taken from the last
+/// stage, following the convention of IS-GPS-200.
+template <std::uint32_t Degree, std::uint32_t Taps>
+constexpr SpreadCode<(1UL << Degree) - 1U> makeMSequence()
+{
+    static_assert((Degree >= 2) && (Degree <= 31));
+    static_assert((Taps & (1UL << (Degree - 1U))) != 0, "The polynomial shall be of the specified degree");
+    SpreadCode<(1UL << Degree) - 1U> out;
+    const std::uint32_t mask = (1UL << Degree) - 1U;
+    std::uint32_t reg = mask;   // Bit 0 is stage 1.
+    for (auto i = 0U; i < out.size(); i++)
+    {
+        out.set(i, ((reg >> (Degree - 1U)) & 1U) != 0);
+        const auto feedback = static_cast<std::uint32_t>(__builtin_parity(reg & Taps));
+        reg = ((reg << 1U) | feedback) & mask;
+    }
+    return out;
+}
+
+/// Generates a member of the Gold code family defined by the preferred pair of m-sequences A and B.
+/// The index in [0, Length) is the delay of B relative to A; each index yields a distinct code of the family,
+/// and the cross-correlation between any two codes of the family is bounded.
+template <std::uint32_t Degree, std::uint32_t TapsA, std::uint32_t TapsB>
+constexpr SpreadCode<(1UL << Degree) - 1U> makeGoldCode(const std::uint32_t index)
+{
+    constexpr auto a = makeMSequence<Degree, TapsA>();
+    constexpr auto b = makeMSequence<Degree, TapsB>();
+    SpreadCode<(1UL << Degree) - 1U> out;
+    for (auto i = 0U; i < out.size(); i++)
+    {
+        out.set(i, a[i] != b[(i + out.size() - (index % out.size())) % out.size()]);
+    }
+    return out;
+}
+
+/// Generates a member of the small Kasami set of the specified m-sequence of even degree. The m-sequence is combined
+/// with its decimation by 2^(Degree/2)+1, which is an m-sequence of period 2^(Degree/2)-1, delayed by the index.
+/// The cross-correlation is bounded by 2^(Degree/2)+1, which is optimal, but the set is small.
+template <std::uint32_t Degree, std::uint32_t Taps>
+constexpr SpreadCode<(1UL << Degree) - 1U> makeKasamiCode(const std::uint32_t index)
+{
+    static_assert((Degree % 2U) == 0U);
+    constexpr auto u = makeMSequence<Degree, Taps>();
+    constexpr std::uint32_t decimation = (1UL << (Degree / 2U)) + 1U;
+    constexpr std::uint32_t period = (1UL << (Degree / 2U)) - 1U;
+    static_assert((u.size() % period) == 0U);
+    SpreadCode<(1UL << Degree) - 1U> out;
+    for (auto i = 0U; i < out.size(); i++)
+    {
+        const auto w = u[static_cast<std::uint32_t>((static_cast<std::uint64_t>(i + index) * decimation) % out.size())];
+        out.set(i, u[i] != w);
+    }
+    return out;
+}
+
+/// The GPS C/A codes: the Gold codes generated by G1 = x^10+x^3+1 and G2 = x^10+x^9+x^8+x^6+x^3+x^2+1,
+/// where the space vehicle PRN number in [1, 32] selects the delay of G2 per IS-GPS-200, table 3-Ia.
+struct GPSCA
+{
+    static constexpr std::uint32_t Degree = 10;
+    static constexpr std::uint32_t TapsG1 = (1U << 9U) | (1U << 2U);
+    static constexpr std::uint32_t TapsG2 = (1U << 9U) | (1U << 8U) | (1U << 7U) | (1U << 5U) | (1U << 2U) | (1U << 1U);
+    static constexpr std::uint32_t PRNCount = 32;
+
+    using Code = SpreadCode<(1UL << Degree) - 1U>;
+
+    static constexpr std::array<std::uint16_t, PRNCount> G2Delay{{
+        5,   6,   7,   8,   17,  18,  139, 140, 141, 251, 252, 254, 255, 256, 257, 258,
+        469, 470, 471, 472, 473, 474, 509, 512, 513, 514, 515, 516, 859, 860, 861, 862,
+    }};
+
+    /// The code for the specified PRN number in [1, 32], e.g., GPSCA::make<1>().
+    template <std::uint32_t PRN>
+    static constexpr Code make()
+    {
+        static_assert((PRN >= 1) && (PRN <= PRNCount));
+        return makeGoldCode<Degree, TapsG1, TapsG2>(G2Delay[PRN - 1U]);
+    }
+
+    /// All codes of the family indexed by PRN-1. The table is generated during compilation.
+    static constexpr std::array<Code, PRNCount> makeTable()
+    {
+        std::array<Code, PRNCount> out{};
+        for (auto i = 0U; i < PRNCount; i++)
+        {
+            out[i] = makeGoldCode<Degree, TapsG1, TapsG2>(G2Delay[i]);
+        }
+        return out;
+    }
+};
+
+/// The small Kasami set of length 255 generated by x^8+x^4+x^3+x^2+1; the PRN number in [1, 15] selects the delay.
+/// There are no preferred pairs of degree 8, so the Gold construction is not applicable to this length.
+struct Kasami255
+{
+    static constexpr std::uint32_t Degree = 8;
+    static constexpr std::uint32_t Taps = (1U << 7U) | (1U << 3U) | (1U << 2U) | (1U << 1U);
+    static constexpr std::uint32_t PRNCount = 15;
+
+    using Code = SpreadCode<(1UL << Degree) - 1U>;
+
+    static constexpr std::array<Code, PRNCount> makeTable()
+    {
+        std::array<Code, PRNCount> out{};
+        for (auto i = 0U; i < PRNCount; i++)
+        {
+            out[i] = makeKasamiCode<Degree, Taps>(i);
+        }
+        return out;
+    }
+};
+
+/// Gold codes of length 63 generated by the preferred pair x^6+x+1 and x^6+x^5+x^2+x+1;
+/// the PRN number in [1, 32] selects the delay.
+struct Gold63
+{
+    static constexpr std::uint32_t Degree = 6;
+    static constexpr std::uint32_t TapsA = (1U << 5U) | 1U;
+    static constexpr std::uint32_t TapsB = (1U << 5U) | (1U << 4U) | (1U << 1U) | 1U;
+    static constexpr std::uint32_t PRNCount = 32;
+
+    using Code = SpreadCode<(1UL << Degree) - 1U>;
+
+    static constexpr std::array<Code, PRNCount> makeTable()
+    {
+        std::array<Code, PRNCount> out{};
+        for (auto i = 0U; i < PRNCount; i++)
+        {
+            out[i] = makeGoldCode<Degree, TapsA, TapsB>(i + 1U);
+        }
+        return out;
+    }
+};
+
+/// Gold codes of length 2047 generated by the preferred pair x^11+x^2+1 and x^11+x^8+x^5+x^2+1.
+/// The index selects the relative delay of the two m-sequences.
+template <std::uint32_t Index>
+constexpr SpreadCode<2047> makeGold2047()
+{
+    return makeGoldCode<11, (1U << 10U) | (1U << 1U), (1U << 10U) | (1U << 7U) | (1U << 4U) | (1U << 1U)>(Index);
+}
+
+/// Longer m-sequences for links that need more processing gain; 4095 and 8191 chips respectively.
+/// The characteristic polynomials are x^12+x^6+x^4+x+1 and x^13+x^4+x^3+x+1.
+constexpr SpreadCode<4095> makeMSequence4095()
+{
+    return makeMSequence<12, (1U << 11U) | (1U << 5U) | (1U << 3U) | 1U>();
+}
+constexpr SpreadCode<8191> makeMSequence8191()
+{
+    return makeMSequence<13, (1U << 12U) | (1U << 3U) | (1U << 2U) | 1U>();
+}
+
+}
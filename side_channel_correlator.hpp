@@ -0,0 +1,1051 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The CDMA correlator that recovers the bits of one link from the samples of the PHY (side_channel_phy.hpp):
+/// the acquisition of the code phase, the tracking of the code phase (DLL) and of the chip rate (FLL), and the
+/// despreading, either sample-by-sample or one code period at a time using the FFT.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_phy.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+
+namespace side_channel::rx
+{
+
+/// Soft-decision correlation retains the magnitude of each sample, which improves the SNR by a few dB.
+static constexpr bool SoftDecision = true;
+/// In the block mode, the correlator processes one code period at a time using the FFT, which is much cheaper
+/// for long spread codes at the expense of one code period of extra latency.
+static constexpr bool BlockCorrelation = false;
+/// The fast acquisition searches the code phase over partial code periods, so the lock is acquired within about one
+/// code period of the signal instead of several; see Correlator. It is not available in the block mode.
+static constexpr bool FastAcquisition = true;
+
+/// Compute mean and standard deviation for the set.
+template <typename S>
+inline std::pair<S, S> computeMeanStdev(const std::vector<S>& cvec)
+{
+    const auto mean = std::accumulate(std::begin(cvec), std::end(cvec), 0.0F) / cvec.size();
+    auto variance = S{};
+    for (auto e : cvec)
+    {
+        variance += std::pow(e - mean, 2) / cvec.size();
+    }
+    return {mean, std::sqrt(variance)};
+}
+
+/// Returns the number of set bits in (a XOR b) over the specified number of 64-bit words.
+/// This is the innermost loop of the correlator, hence the vectorized paths.
+inline std::uint32_t popcountXor(const std::uint64_t* a, const std::uint64_t* b, const std::size_t word_count)
+{
+    std::size_t i = 0;
+    std::uint64_t out = 0;
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    __m512i acc = _mm512_setzero_si512();
+    for (; i < (word_count - (word_count % 8U)); i += 8)
+    {
+        const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    alignas(64) std::uint64_t lanes[8]{};
+    _mm512_store_si512(lanes, acc);
+    out += std::accumulate(std::begin(lanes), std::end(lanes), std::uint64_t{});
+#elif defined(__AVX2__)
+    // There is no native popcount in AVX2, so we use the nibble lookup table method (Mula et al.).
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    for (; i < (word_count - (word_count % 4U)); i += 4)
+    {
+        const __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                           _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        const __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(x, low_mask));
+        const __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    out += static_cast<std::uint64_t>(_mm256_extract_epi64(acc, 0)) +
+           static_cast<std::uint64_t>(_mm256_extract_epi64(acc, 1)) +
+           static_cast<std::uint64_t>(_mm256_extract_epi64(acc, 2)) +
+           static_cast<std::uint64_t>(_mm256_extract_epi64(acc, 3));
+#endif
+    for (; i < word_count; i++)
+    {
+        out += static_cast<std::uint64_t>(__builtin_popcountll(a[i] ^ b[i]));
+    }
+    return static_cast<std::uint32_t>(out);
+}
+
+/// A minimal iterative radix-2 FFT. The size shall be a power of two.
+class FFT
+{
+public:
+    explicit FFT(const std::size_t size) :
+        size_(size),
+        twiddle_(size / 2U),
+        bit_reversal_(size)
+    {
+        assert((size > 1) && ((size & (size - 1U)) == 0));
+        for (auto i = 0U; i < twiddle_.size(); i++)
+        {
+            twiddle_[i] = std::polar(1.0, -2.0 * M_PI * double(i) / double(size));
+        }
+        std::uint32_t bits = 0;
+        while ((1ULL << bits) < size)
+        {
+            bits++;
+        }
+        for (auto i = 0U; i < size; i++)
+        {
+            std::uint32_t r = 0;
+            for (auto b = 0U; b < bits; b++)
+            {
+                r |= ((i >> b) & 1U) << (bits - 1U - b);
+            }
+            bit_reversal_[i] = r;
+        }
+    }
+
+    void forward(std::vector<std::complex<double>>& x) const { transform(x, false); }
+
+    /// The output is normalized, such that inverse(forward(x)) == x.
+    void inverse(std::vector<std::complex<double>>& x) const
+    {
+        transform(x, true);
+        for (auto& v : x)
+        {
+            v /= double(size_);
+        }
+    }
+
+private:
+    void transform(std::vector<std::complex<double>>& x, const bool inverse) const
+    {
+        assert(x.size() == size_);
+        for (auto i = 0U; i < size_; i++)
+        {
+            if (i < bit_reversal_[i])
+            {
+                std::swap(x[i], x[bit_reversal_[i]]);
+            }
+        }
+        for (std::size_t len = 2; len <= size_; len *= 2U)
+        {
+            const auto stride = size_ / len;
+            for (std::size_t i = 0; i < size_; i += len)
+            {
+                for (std::size_t j = 0; j < (len / 2U); j++)
+                {
+                    const auto w = inverse ? std::conj(twiddle_[j * stride]) : twiddle_[j * stride];
+                    const auto u = x[i + j];
+                    const auto v = x[i + j + (len / 2U)] * w;
+                    x[i + j] = u + v;
+                    x[i + j + (len / 2U)] = u - v;
+                }
+            }
+        }
+    }
+
+    const std::size_t size_;
+    std::vector<std::complex<double>> twiddle_;
+    std::vector<std::uint32_t> bit_reversal_;
+};
+
+/// Holds the correlation state of the real-time input signal against the reference CDMA spread code (chip code)
+/// at one particular code phase. The correlator runs a set of channels concurrently, separated by a fixed phase offset.
+/// The correlation estimate ranges in [0.0, 1.0], where 0 represents uncorrelated signal, 1 for perfect correlation.
+/// The channel does not keep a copy of the spread code; the matching is done by the correlator for all channels
+/// at once.
+/// The period is the length of the spread code in samples; it is a compile-time constant of the code type.
+template <std::uint32_t Period>
+class CorrelationChannel
+{
+    static_assert(Period > 0);
+
+public:
+    /// The bit clock can be trivially extracted from a code phase locked CDMA link.
+    /// In this implementation, the leading edge of the clock occurs near the middle of the spread code period.
+    /// The clock edge lags the bit it relates to by one spread code period.
+    struct Result
+    {
+        float correlation = 0.0F;
+        float weight = 0.0F;    ///< See getWeight().
+        bool data;
+        bool clock;
+    };
+
+    /// Invoked once per spread code period when the code phase of this channel rolls over.
+    void update(const std::uint32_t match_hi, const std::uint32_t match_lo)
+    {
+        const bool hi_top = match_hi > match_lo;
+        const auto top = hi_top ? match_hi : match_lo;
+        const auto bot = hi_top ? match_lo : match_hi;
+        assert(top >= bot);
+        correlation_ = static_cast<float>(top - bot) / static_cast<float>(Period);
+        state_ = hi_top;
+        updateWeight();
+    }
+
+    /// Soft-decision version of the above: the sum of the products of the samples with the code (+1 or -1)
+    /// over the code period, and the sum of the magnitudes of the samples over the same period.
+    void update(const float sum, const float norm)
+    {
+        correlation_ = (norm > 0.0F) ? std::min(1.0F, std::fabs(sum) / norm) : 0.0F;
+        state_ = sum > 0.0F;
+        updateWeight();
+    }
+
+    /// The position is the number of samples consumed since the last rollover, in [1, Period].
+    Result getResult(const std::uint32_t position) const
+    {
+        return {
+            correlation_,
+            weight_,
+            state_,
+            position > Period / 2
+        };
+    }
+
+    /// The weight of the channel in the aggregate output of the correlator. Nonlinear weighting helps suppress
+    /// noise from uncorrelated channels. It only changes at the rollover, so it is computed there.
+    float getWeight() const { return weight_; }
+
+    /// Diagnistic accessor. Not part of the main business logic.
+    float getCorrelation() const { return correlation_; }
+
+private:
+    void updateWeight()
+    {
+        const float sq = correlation_ * correlation_;
+        weight_ = sq * sq;
+    }
+
+    float correlation_ = 0.0F;
+    float weight_ = 0.0F;
+    bool state_ = false;
+};
+
+/// The clock is recovered from the spread code along with the data.
+/// Positive values represent truth, negative values represent falsity.
+/// The result type is shared by all specializations of the correlator, so that they are interchangeable at runtime.
+struct CorrelatorResult
+{
+    float data  = 0.0F;
+    float clock = 0.0F;  ///< active high
+
+    /// M-ary mode only: the bits of the symbol that ends with this sample, the first bit in the MSB.
+    /// The symbols are detected only while tracking, in which case the data and clock outputs above are zero;
+    /// otherwise, the data and clock outputs are used as in the binary mode.
+    std::uint32_t symbol = 0;
+    std::uint8_t  symbol_bits = 0;  ///< Zero if no symbol ends with this sample.
+};
+
+/// The correlator is specialized for hard-decision samples (bool) or soft-decision samples (float).
+/// The hard-decision samples are matched against the code using XOR+popcount over packed words.
+/// The soft-decision samples are signed values that are positive if the PHY is likely driven high, and whose
+/// magnitude represents the confidence; they are multiplied by the code (+1 for high chips, -1 for low chips)
+/// and accumulated, which retains the magnitude information that the hard decision throws away.
+/// The correlator is also specialized on the spread code type, so that the sequence length is known at compile time.
+///
+/// The receiver operates in two stages. During the acquisition, every code phase is correlated on every sample
+/// to find the phase of the incoming signal. Once the lock is confirmed, the correlator hands over to a delay-locked
+/// loop (DLL) that updates only the early, prompt, and late channels around the correlation peak and steers the
+/// prompt phase towards the stronger of its neighbors; the other channels are not updated at all.
+/// If the prompt correlation decays into the noise floor, the correlator drops back to the acquisition.
+///
+/// The channels publish their correlations once per code period only, and the lock is confirmed over several
+/// periods, so the acquisition takes several code periods. The fast acquisition runs alongside every quarter of
+/// the code period: the most recent half period of samples is summed coherently per chip and correlated with the code
+/// at every chip-spaced code phase, which is much cheaper than at every sample-spaced one. If the strongest coarse
+/// phase stands out of the others, the sample-spaced phases around it are evaluated exactly over the same samples to
+/// refine it, and once two consecutive searches agree, the refined phase is handed over to the tracking loop at once.
+///
+/// In the M-ary code-shift keying mode (ShiftBits > 0; see side_channel::params::LinkProfile), the acquisition is
+/// done on the unshifted code that is sent in the preamble. While tracking, the code period that ends at
+/// the rollover of the prompt channel is aligned with the symbol, so its circular correlation with the code
+/// computed via the FFT peaks at the lag of the transmitted shift. The early/prompt/late samples of the DLL
+/// are taken around the detected peak instead of the unshifted prompt channel.
+///
+/// The oversampling factor (samples per chip) is a parameter only for benchmarking; the receiver always uses
+/// OversamplingFactor because it samples the PHY at a fixed rate.
+template <typename Code, typename Sample, std::uint32_t ShiftBits = 0, std::uint32_t Oversampling = OversamplingFactor>
+class Correlator
+{
+    static_assert(std::is_same_v<Sample, bool> || std::is_same_v<Sample, float>);
+    static constexpr bool IsSoft = std::is_same_v<Sample, float>;
+    static constexpr bool IsMAry = ShiftBits > 0;
+
+public:
+    static constexpr std::uint32_t SequenceLength = Code::Length * Oversampling;
+    static constexpr std::uint32_t SymbolBits = ShiftBits + 1U;
+    /// Same as side_channel::params::LinkProfile::ShiftSpacing but in samples rather than chips.
+    static constexpr std::uint32_t ShiftSpacing = (Code::Length >> ShiftBits) * Oversampling;
+
+private:
+    static constexpr std::uint32_t WordBits = 64;
+    static constexpr std::uint32_t WordCount = (SequenceLength + WordBits - 1U) / WordBits;
+    /// The circular correlation is exact for the first SequenceLength lags if the FFT covers two code periods.
+    static constexpr std::size_t FFTSize = [] {
+        std::size_t x = 1;
+        while (x < (SequenceLength * 2U))
+        {
+            x *= 2U;
+        }
+        return x;
+    }();
+
+public:
+    using Result = CorrelatorResult;
+
+    explicit Correlator(const Code& code) :
+        channels_(SequenceLength),
+        fft_(FFTSize),
+        fft_buffer_(FFTSize),
+        code_spectrum_(FFTSize),
+        symbol_buffer_(IsMAry ? FFTSize : 0U)
+    {
+        // Pack the spread code sequence where each bit is expanded by the oversampling factor.
+        // The code is stored only once; each channel is offset from it by the sampling period.
+        for (auto i = 0U; i < code.size(); i++)
+        {
+            for (auto j = 0U; j < Oversampling; j++)
+            {
+                if (code[i])
+                {
+                    setBit(code_, i * Oversampling + j);
+                }
+            }
+        }
+        // The chips of the code repeated twice for the coarse search of the fast acquisition.
+        code_chips_.resize(Code::Length * 2U);
+        for (auto i = 0U; i < code_chips_.size(); i++)
+        {
+            code_chips_[i] = code[i % Code::Length] ? 1.0F : -1.0F;
+        }
+        if constexpr (IsSoft)
+        {
+            // The code is repeated twice so that it can be matched against the circular history contiguously.
+            code_signs_.resize(SequenceLength * 2U);
+            for (auto i = 0U; i < code_signs_.size(); i++)
+            {
+                code_signs_[i] = getBit(code_, i % SequenceLength) ? 1.0F : -1.0F;
+            }
+            history_.resize(SequenceLength, 0.0F);
+        }
+        // The conjugated spectrum of the code is needed for the cross-correlation in the block mode.
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            code_spectrum_[i] = getBit(code_, i) ? 1.0 : -1.0;
+        }
+        fft_.forward(code_spectrum_);
+        for (auto& x : code_spectrum_)
+        {
+            x = std::conj(x);
+        }
+    }
+
+    Result feed(const Sample sample)
+    {
+        // Channel K consumes the sample against the code bit at (K + sample_count_) modulo the sequence length,
+        // so exactly one channel completes its code period per sample. The history holds the last SequenceLength
+        // samples starting from the oldest one, which is exactly the alignment of the code for the channel that
+        // rolls over now, so its match count is a single XOR+popcount over the packed words (or a dot product).
+        // During the tracking, only the three tracked channels are updated, so most samples cost nearly nothing.
+        std::optional<std::uint32_t> symbol;
+        if constexpr (IsMAry)
+        {
+            if (isSymbolBoundary())
+            {
+                symbol = detectSymbol([this](const std::uint32_t i) { return getHistory(i); });
+            }
+        }
+        if ((sample_count_ > 0) && (!tracking_ || isTracked(getRolloverIndex())))
+        {
+            if constexpr (IsSoft)
+            {
+                // The missing samples before the history is filled up are zeros, so they do not contribute.
+                const float* const code = &code_signs_[SequenceLength - history_head_];
+                float sum = 0.0F;
+                float norm = 0.0F;
+                for (auto i = 0U; i < SequenceLength; i++)
+                {
+                    sum  += history_[i] * code[i];
+                    norm += std::fabs(history_[i]);
+                }
+                updateRolloverChannel(sum, norm);
+            }
+            else
+            {
+                const auto valid = getValidHistoryLength();
+                // Before the history is filled up, the missing samples are zeros that must not be counted as matches.
+                const auto lo = popcountXor(history_.data(), code_.data(), WordCount) -
+                                countOnes(code_, SequenceLength - valid);
+                updateRolloverChannel(valid - lo, lo);
+            }
+        }
+        pushHistory(sample);
+        if constexpr (FastAcquisition)
+        {
+            if (!tracking_ && (((sample_count_ + 1U) % FastAcquisitionStep) == 0U))
+            {
+                updateFastAcquisition();
+            }
+        }
+        return advance(symbol);
+    }
+
+    /// Block (batch) mode: accepts exactly one code period of samples and returns the same per-sample results that
+    /// would be returned by feed() for the same samples, but computes the correlation of every code phase at once
+    /// using the FFT, which costs O(N log N) per code period instead of O(N^2).
+    /// The results are delayed by one code period relative to the streaming mode. The two modes can be interleaved.
+    std::vector<Result> feedBlock(const std::vector<Sample>& block)
+    {
+        assert(block.size() == SequenceLength);
+        // The channel that rolls over at the M-th sample of the block is matched against the window that begins at
+        // the M-th sample of the concatenation of the history and the block, so the match counts for all channels
+        // are given by the linear cross-correlation of that concatenation with the code, computed via the FFT.
+        const auto valid_history = getValidHistoryLength();
+        std::fill(std::begin(fft_buffer_), std::end(fft_buffer_), std::complex<double>{});
+        for (auto i = SequenceLength - valid_history; i < SequenceLength; i++)
+        {
+            fft_buffer_[i] = getHistory(i);     // Missing samples are zero, i.e., do not contribute.
+        }
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            fft_buffer_[SequenceLength + i] = toSigned(block[i]);
+        }
+        // The M-ary symbol detector needs the window of the prompt channel, which is destroyed by the FFT below.
+        std::vector<double> window;
+        if constexpr (IsMAry)
+        {
+            window.resize(SequenceLength * 2U);
+            std::transform(std::begin(fft_buffer_),
+                           std::begin(fft_buffer_) + window.size(),
+                           std::begin(window),
+                           [](const std::complex<double>& x) { return x.real(); });
+        }
+        // The soft correlation is normalized by the sum of magnitudes over the window of each channel.
+        std::vector<double> magnitude_prefix;
+        if constexpr (IsSoft)
+        {
+            magnitude_prefix.resize(SequenceLength * 2U + 1U, 0.0);
+            for (auto i = 0U; i < (SequenceLength * 2U); i++)
+            {
+                magnitude_prefix[i + 1U] = magnitude_prefix[i] + std::abs(fft_buffer_[i].real());
+            }
+        }
+        fft_.forward(fft_buffer_);
+        for (auto i = 0U; i < fft_buffer_.size(); i++)
+        {
+            fft_buffer_[i] *= code_spectrum_[i];
+        }
+        fft_.inverse(fft_buffer_);
+
+        std::vector<Result> out;
+        out.reserve(SequenceLength);
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            std::optional<std::uint32_t> symbol;
+            if constexpr (IsMAry)
+            {
+                if (isSymbolBoundary())
+                {
+                    symbol = detectSymbol([&window, i](const std::uint32_t k) { return window[i + k]; });
+                }
+            }
+            if (sample_count_ > 0)
+            {
+                if constexpr (IsSoft)
+                {
+                    const auto norm = magnitude_prefix[i + SequenceLength] - magnitude_prefix[i];
+                    updateRolloverChannel(static_cast<float>(fft_buffer_[i].real()), static_cast<float>(norm));
+                }
+                else
+                {
+                    // The cross-correlation equals the number of matches minus the number of mismatches.
+                    const auto valid = getValidHistoryLength();
+                    const auto diff = static_cast<std::int64_t>(std::lround(fft_buffer_[i].real()));
+                    assert(std::abs(diff) <= valid);
+                    const auto hi = static_cast<std::uint32_t>((valid + diff) / 2);
+                    updateRolloverChannel(hi, valid - hi);
+                }
+            }
+            out.push_back(advance(symbol));
+        }
+
+        if constexpr (IsSoft)
+        {
+            std::copy(std::begin(block), std::end(block), std::begin(history_));
+            history_head_ = 0;
+        }
+        else
+        {
+            history_.fill(0);
+            for (auto i = 0U; i < SequenceLength; i++)
+            {
+                if (block[i])
+                {
+                    setBit(history_, i);
+                }
+            }
+        }
+        return out;
+    }
+
+    /// Correlation factor per each correlator.
+    std::vector<float> getCorrelationVector() const
+    {
+        std::vector<float> out;
+        std::transform(std::begin(channels_),
+                       std::end(channels_),
+                       std::back_insert_iterator(out),
+                       [](const Channel& x) { return x.getCorrelation(); });
+        return out;
+    }
+
+    /// True if the acquisition is complete and the delay-locked loop is tracking the code phase.
+    bool isTracking() const { return tracking_; }
+
+    /// The index of the prompt channel of the tracking loop. Meaningless unless tracking.
+    std::uint32_t getPromptIndex() const { return prompt_; }
+
+    /// The estimated relative frequency error of the incoming code with respect to the sampling clock;
+    /// positive if the transmitter is fast. This is the output of the frequency tracking loop that should be applied
+    /// to the sampling clock; see readPHY(). The estimate is retained when the lock is lost.
+    double getRateCorrection() const
+    {
+        return rate_integrator_ + (tracking_ ? (FLLProportionalGain * phase_error_ / SequenceLength) : 0.0);
+    }
+
+    /// The integral part of the above, which is the long-term clock error estimate, for diagnostic purposes.
+    double getClockError() const { return rate_integrator_; }
+
+    /// The clock error is a property of the hosts rather than of the link profile, so it is carried over
+    /// when the correlator is replaced with one for a different profile.
+    void setClockError(const double value) { rate_integrator_ = value; }
+
+    /// The latest code phase error of the prompt channel in samples estimated by the DLL discriminator.
+    float getCodePhaseError() const { return tracking_ ? phase_error_ : 0.0F; }
+
+    /// The strongest correlation of the code phase, and the mean correlation of all code phases during the acquisition
+    /// or the noise floor estimated at the handover while tracking, because the other channels are not updated then.
+    /// Unlike getCorrelationVector(), this does not allocate memory, so it is cheap enough to be called for every bit.
+    std::pair<float, float> getPeakAndFloor() const
+    {
+        if (tracking_)
+        {
+            return {
+                std::max({channels_[getEarlyIndex()].getCorrelation(),
+                          channels_[prompt_].getCorrelation(),
+                          channels_[getLateIndex()].getCorrelation()}),
+                noise_floor_
+            };
+        }
+        float peak = 0.0F;
+        double sum = 0.0;
+        for (const auto& c : channels_)
+        {
+            peak = std::max(peak, c.getCorrelation());
+            sum += c.getCorrelation();
+        }
+        return {peak, static_cast<float>(sum / SequenceLength)};
+    }
+
+    /// Performs a simple heuristic assessment of the code phase lock. This is unreliable though.
+    /// This is only meaningful during the acquisition because the untracked channels are not updated afterwards.
+    bool isCodePhaseSynchronized(const float stdev_multiple_threshold = AcquisitionStdevMultiple) const
+    {
+        const auto cvec = getCorrelationVector();
+        const auto [mean, stdev] = computeMeanStdev(cvec);
+        const auto max = *std::max_element(std::begin(cvec), std::end(cvec));
+        return (max - mean) > (stdev * stdev_multiple_threshold);
+    }
+
+private:
+    /// The acquisition is confirmed if the heuristic lock holds for this many consecutive code periods.
+    static constexpr float         AcquisitionStdevMultiple = 5.0F;
+    static constexpr std::uint32_t AcquisitionConfirmPeriods = 3;
+    /// The lock is considered lost if the prompt correlation stays below the noise floor (estimated at the handover)
+    /// plus this many standard deviations for this many consecutive code periods. The threshold is lower than
+    /// the acquisition threshold to provide hysteresis.
+    static constexpr float         LossStdevMultiple = 3.0F;
+    static constexpr std::uint32_t LossConfirmPeriods = 3;
+    /// The fast acquisition searches the most recent window of whole chips every step; the strongest coarse code phase
+    /// shall exceed the mean of all coarse phases by this many standard deviations in this many consecutive steps.
+    /// The threshold is higher than that of the regular acquisition because the sums are shorter and more frequent.
+    static constexpr std::uint32_t FastAcquisitionWindow = (SequenceLength / 2U / Oversampling) * Oversampling;
+    static constexpr std::uint32_t FastAcquisitionStep = SequenceLength / 4U;
+    static constexpr float         FastAcquisitionStdevMultiple = 6.0F;
+    static constexpr std::uint32_t FastAcquisitionConfirmSteps = 2;
+    static_assert(FastAcquisitionWindow > 0U);
+    /// The DLL discriminator (E-L)/(E+L) is accumulated once per code period; the prompt phase is moved by one
+    /// sample towards the early or late channel when the accumulator reaches this value. The loop can follow a clock
+    /// drift of at most one sample per code period; a faster drift breaks the lock and restarts the acquisition.
+    static constexpr float DLLShiftThreshold = 0.5F;
+    /// The frequency tracking loop is a proportional-integral filter driven by the DLL code phase error once per
+    /// code period. As the sampling clock is corrected, the peak stops moving across the channels.
+    static constexpr double FLLProportionalGain = 0.25;
+    static constexpr double FLLIntegralGain = 1.0 / 64.0;
+    /// The discriminator of a rectangular chip correlation triangle is proportional to the phase error in samples.
+    static constexpr float DiscriminatorScale = float(std::max(1, int(Oversampling) - 1));
+
+    using Bits = std::array<std::uint64_t, WordCount>;
+    /// The hard-decision history is packed; the soft-decision history is a circular buffer.
+    using History = std::conditional_t<IsSoft, std::vector<float>, Bits>;
+
+    static void setBit(Bits& bits, const std::uint32_t index)
+    {
+        bits.at(index / WordBits) |= 1ULL << (index % WordBits);
+    }
+
+    static bool getBit(const Bits& bits, const std::uint32_t index)
+    {
+        return (bits.at(index / WordBits) & (1ULL << (index % WordBits))) != 0;
+    }
+
+    static double toSigned(const Sample sample)
+    {
+        if constexpr (IsSoft)
+        {
+            return sample;
+        }
+        else
+        {
+            return sample ? 1.0 : -1.0;
+        }
+    }
+
+    /// Number of set bits in [0, bit_count).
+    static std::uint32_t countOnes(const Bits& bits, const std::uint32_t bit_count)
+    {
+        std::uint32_t out = 0;
+        for (auto i = 0U; i < (bit_count / WordBits); i++)
+        {
+            out += static_cast<std::uint32_t>(__builtin_popcountll(bits[i]));
+        }
+        if ((bit_count % WordBits) != 0)
+        {
+            const auto mask = (1ULL << (bit_count % WordBits)) - 1U;
+            out += static_cast<std::uint32_t>(__builtin_popcountll(bits[bit_count / WordBits] & mask));
+        }
+        return out;
+    }
+
+    /// Appends the new sample to the history, evicting the oldest one.
+    void pushHistory(const Sample sample)
+    {
+        if constexpr (IsSoft)
+        {
+            history_[history_head_] = sample;
+            history_head_ = (history_head_ + 1U) % SequenceLength;
+        }
+        else
+        {
+            // Shift the history towards the oldest sample by one position and put the new sample at the end.
+            for (auto i = 0U; i < (WordCount - 1U); i++)
+            {
+                history_[i] = (history_[i] >> 1U) | (history_[i + 1U] << (WordBits - 1U));
+            }
+            history_[WordCount - 1U] >>= 1U;
+            if (sample)
+            {
+                setBit(history_, SequenceLength - 1U);
+            }
+        }
+    }
+
+    /// The index-th sample of the history counting from the oldest one as a signed value.
+    double getHistory(const std::uint32_t index) const
+    {
+        if constexpr (IsSoft)
+        {
+            return history_[(history_head_ + index) % SequenceLength];
+        }
+        else
+        {
+            return getBit(history_, index) ? 1.0 : -1.0;
+        }
+    }
+
+    /// The index of the channel whose code period is completed by the next sample.
+    std::uint32_t getRolloverIndex() const { return (SequenceLength - phase_) % SequenceLength; }
+
+    std::uint32_t wrap(const std::int64_t index) const
+    {
+        return static_cast<std::uint32_t>(((index % SequenceLength) + SequenceLength) % SequenceLength);
+    }
+
+    std::uint32_t getEarlyIndex() const { return wrap(std::int64_t(prompt_) + 1); }
+    std::uint32_t getLateIndex()  const { return wrap(std::int64_t(prompt_) - 1); }
+
+    bool isTracked(const std::uint32_t index) const
+    {
+        return (index == prompt_) || (index == getEarlyIndex()) || (index == getLateIndex());
+    }
+
+    /// Invoked once per code period during the acquisition.
+    void updateAcquisition()
+    {
+        if ((sample_count_ <= SequenceLength) || !isCodePhaseSynchronized())
+        {
+            acquisition_count_ = 0;
+            return;
+        }
+        if (++acquisition_count_ < AcquisitionConfirmPeriods)
+        {
+            return;
+        }
+        const auto cvec = getCorrelationVector();
+        const auto [mean, stdev] = computeMeanStdev(cvec);
+        startTracking(static_cast<std::uint32_t>(std::max_element(std::begin(cvec), std::end(cvec)) - std::begin(cvec)),
+                      mean,
+                      stdev);
+    }
+
+    /// Invoked every FastAcquisitionStep samples during the acquisition after the sample is pushed into the history.
+    void updateFastAcquisition()
+    {
+        // The history sample I is matched by channel K against the code sample (K + count + I) modulo the sequence
+        // length, so the channel that matches the first sample of the window against the first sample of the coarse
+        // code phase L (in chips) is K = L * Oversampling - count - (SequenceLength - window).
+        const auto count = sample_count_ + 1U;
+        if (count < FastAcquisitionWindow)
+        {
+            return;
+        }
+        constexpr auto WindowStart = SequenceLength - FastAcquisitionWindow;
+        constexpr auto ChipCount = FastAcquisitionWindow / Oversampling;
+        double norm = 0.0;
+        for (auto j = 0U; j < ChipCount; j++)
+        {
+            float sum = 0.0F;
+            for (auto k = 0U; k < Oversampling; k++)
+            {
+                const auto x = getHistory(WindowStart + (j * Oversampling) + k);
+                sum += static_cast<float>(x);
+                norm += std::abs(x);
+            }
+            coarse_chips_[j] = sum;
+        }
+        std::uint32_t best = 0;
+        for (auto lag = 0U; lag < Code::Length; lag++)
+        {
+            float sum = 0.0F;
+            for (auto j = 0U; j < ChipCount; j++)
+            {
+                sum += coarse_chips_[j] * code_chips_[lag + j];
+            }
+            coarse_correlation_[lag] = std::fabs(sum);
+            best = (coarse_correlation_[lag] > coarse_correlation_[best]) ? lag : best;
+        }
+        // The statistics of the noise exclude the peak and its neighbors, which the misaligned chips leak into;
+        // otherwise, the peak would inflate the deviation so much that it could never stand out of a short code.
+        double mean = 0.0;
+        double sq_sum = 0.0;
+        for (auto lag = 0U; lag < Code::Length; lag++)
+        {
+            const auto distance = (lag + Code::Length - best) % Code::Length;
+            if ((distance > 1U) && (distance < (Code::Length - 1U)))
+            {
+                mean += coarse_correlation_[lag];
+                sq_sum += double(coarse_correlation_[lag]) * coarse_correlation_[lag];
+            }
+        }
+        mean /= (Code::Length - 3U);
+        const double stdev = std::sqrt(std::max(0.0, (sq_sum / (Code::Length - 3U)) - (mean * mean)));
+        if ((norm <= 0.0) || ((coarse_correlation_[best] - mean) <= (stdev * FastAcquisitionStdevMultiple)))
+        {
+            fast_acquisition_count_ = 0;
+            return;
+        }
+        // The chips of the signal are not aligned with the window, so the true phase is within one chip of the coarse.
+        const auto coarse = std::int64_t(best * Oversampling) - std::int64_t(count) + FastAcquisitionWindow;
+        std::uint32_t refined = wrap(coarse);
+        double refined_correlation = -1.0;
+        for (auto d = -std::int64_t(Oversampling); d <= std::int64_t(Oversampling); d++)
+        {
+            const auto channel = wrap(coarse + d);
+            double sum = 0.0;
+            for (auto i = WindowStart; i < SequenceLength; i++)
+            {
+                sum += getHistory(i) * (getBit(code_, wrap(std::int64_t(channel) + std::int64_t(count) + i)) ? 1 : -1);
+            }
+            if (std::abs(sum) > refined_correlation)
+            {
+                refined_correlation = std::abs(sum);
+                refined = channel;
+            }
+        }
+        // The candidate shall stay at the same code phase, give or take the drift of one sample.
+        const auto distance = wrap(std::int64_t(refined) - std::int64_t(fast_acquisition_candidate_));
+        const bool same = (fast_acquisition_count_ > 0) && ((distance <= 1U) || (distance >= (SequenceLength - 1U)));
+        fast_acquisition_candidate_ = refined;
+        fast_acquisition_count_ = same ? (fast_acquisition_count_ + 1U) : 1U;
+        if (fast_acquisition_count_ >= FastAcquisitionConfirmSteps)
+        {
+            // The noise floor is estimated from the coarse correlations normalized like those of the channels.
+            startTracking(refined, static_cast<float>(mean / norm), static_cast<float>(stdev / norm));
+        }
+    }
+
+    /// Hands over from the acquisition to the tracking loop with the specified prompt channel. The statistics of
+    /// the correlation of the code phases at the handover define the noise floor used to detect the loss of the lock.
+    void startTracking(const std::uint32_t prompt, const float mean, const float stdev)
+    {
+        loss_threshold_ = mean + stdev * LossStdevMultiple;
+        noise_floor_ = mean;
+        prompt_ = prompt;
+        tracking_ = true;
+        aggregate_valid_ = false;   // Not maintained while tracking.
+        loss_count_ = 0;
+        dll_accumulator_ = 0.0F;
+        acquisition_count_ = 0;
+        fast_acquisition_count_ = 0;
+        // The untracked channels are reset so that they do not affect the output or re-enter the loop stale.
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            if (!isTracked(i))
+            {
+                channels_[i] = Channel{};
+            }
+        }
+    }
+
+    /// Invoked once per code period during the tracking with the correlation magnitudes at the code phases
+    /// one sample ahead of the prompt phase, at the prompt phase, and one sample behind it.
+    void updateTracking(const float early, const float prompt, const float late)
+    {
+        if (std::max({early, prompt, late}) < loss_threshold_)
+        {
+            if (++loss_count_ >= LossConfirmPeriods)
+            {
+                tracking_ = false;
+                acquisition_count_ = 0;
+                fast_acquisition_count_ = 0;
+            }
+            return;
+        }
+        loss_count_ = 0;
+        const float discriminator = ((early + late) > 0.0F) ? ((early - late) / (early + late)) : 0.0F;
+        dll_accumulator_ += discriminator;
+        phase_error_ = discriminator * DiscriminatorScale;
+        rate_integrator_ += FLLIntegralGain * phase_error_ / SequenceLength;
+        if (std::fabs(dll_accumulator_) >= DLLShiftThreshold)
+        {
+            // The channel that leaves the window is reset; the one that enters it is already reset.
+            const bool to_early = dll_accumulator_ > 0.0F;
+            channels_[to_early ? getLateIndex() : getEarlyIndex()] = Channel{};
+            prompt_ = to_early ? getEarlyIndex() : getLateIndex();
+            dll_accumulator_ = 0.0F;
+        }
+    }
+
+    /// The number of samples in the history that have actually been received.
+    std::uint32_t getValidHistoryLength() const
+    {
+        return static_cast<std::uint32_t>(std::min<std::uint64_t>(sample_count_, SequenceLength));
+    }
+
+    /// True if the code period of the prompt channel ends with the next sample. When the DLL moves the prompt phase
+    /// one sample behind, the new prompt channel rolls over immediately after the old one, which is the same symbol.
+    bool isSymbolBoundary() const
+    {
+        return tracking_ &&
+               (getRolloverIndex() == prompt_) &&
+               ((sample_count_ - last_symbol_sample_) > (SequenceLength / 2U));
+    }
+
+    /// Computes the circular correlation of the code period that ends now, which is aligned with the symbol,
+    /// against the code, picks the shift of the strongest correlation, and updates the tracking loop around it.
+    /// The window accessor returns the K-th sample of the code period as a signed value.
+    template <typename Window>
+    std::uint32_t detectSymbol(const Window& window)
+    {
+        last_symbol_sample_ = sample_count_;
+        std::fill(std::begin(symbol_buffer_), std::end(symbol_buffer_), std::complex<double>{});
+        double norm = 0.0;
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            const auto x = window(i);
+            symbol_buffer_[i] = x;
+            symbol_buffer_[i + SequenceLength] = x;     // Repeated to turn the linear correlation into circular.
+            norm += std::abs(x);
+        }
+        fft_.forward(symbol_buffer_);
+        for (auto i = 0U; i < symbol_buffer_.size(); i++)
+        {
+            symbol_buffer_[i] *= code_spectrum_[i];
+        }
+        fft_.inverse(symbol_buffer_);
+        // If the code is shifted by S samples, the correlation peaks at the lag -S (modulo the sequence length).
+        // The code phase one sample ahead of the prompt phase (the early one) is at the lag one less than the peak.
+        const auto at = [this, norm](const std::int64_t lag)
+        {
+            return (norm > 0.0) ? static_cast<float>(symbol_buffer_[wrap(lag)].real() / norm) : 0.0F;
+        };
+        std::uint32_t best = 0;
+        for (auto k = 1U; k < (1U << ShiftBits); k++)
+        {
+            if (std::fabs(at(-std::int64_t(k * ShiftSpacing))) > std::fabs(at(-std::int64_t(best * ShiftSpacing))))
+            {
+                best = k;
+            }
+        }
+        const auto lag = -std::int64_t(best * ShiftSpacing);
+        const auto prompt = at(lag);
+        updateTracking(std::fabs(at(lag - 1)), std::fabs(prompt), std::fabs(at(lag + 1)));
+        return ((prompt > 0.0F) ? (1U << ShiftBits) : 0U) | best;
+    }
+
+    static double vote(const bool value, const float weight) { return value ? weight : -weight; }
+
+    /// The position of channel K is the number of samples it consumed since its last rollover.
+    std::uint32_t getPosition(const std::uint32_t index) const { return ((phase_ + index) % SequenceLength) + 1U; }
+
+    /// The index of the channel whose clock output goes high with the next sample; see CorrelationChannel.
+    std::uint32_t getMidpointIndex() const { return wrap(std::int64_t(SequenceLength / 2U) - phase_); }
+
+    /// Updates the channel that completes its code period with the next sample and adjusts the aggregate output
+    /// of the acquisition by the change of its contribution. Its clock output is high until it rolls over.
+    template <typename... Args>
+    void updateRolloverChannel(const Args... args)
+    {
+        auto& channel = channels_[getRolloverIndex()];
+        const auto before = channel.getResult(SequenceLength);
+        channel.update(args...);
+        const auto after = channel.getResult(SequenceLength);
+        data_sum_  += vote(after.data, after.weight) - vote(before.data, before.weight);
+        clock_sum_ += vote(after.clock, after.weight) - vote(before.clock, before.weight);
+    }
+
+    /// The aggregate output of the acquisition is the sum of the weighted votes of all channels. Only two channels
+    /// change their votes per sample: the one that rolls over (see updateRolloverChannel()) and the one whose clock
+    /// output goes high, so the sums are adjusted incrementally. They are recomputed once per code period to keep
+    /// the rounding errors from accumulating, and after the tracking, during which they are not maintained.
+    void updateAggregate()
+    {
+        if (aggregate_valid_ && (phase_ != 0))
+        {
+            clock_sum_ -= 2.0 * channels_[getRolloverIndex()].getWeight();
+            clock_sum_ += 2.0 * channels_[getMidpointIndex()].getWeight();
+            return;
+        }
+        data_sum_ = 0.0;
+        clock_sum_ = 0.0;
+        for (auto i = 0U; i < SequenceLength; i++)
+        {
+            const auto res = channels_[i].getResult(getPosition(i));
+            data_sum_  += vote(res.data, res.weight);
+            clock_sum_ += vote(res.clock, res.weight);
+        }
+        aggregate_valid_ = true;
+    }
+
+    /// Consumes one sample after the rolled over channel has been updated and computes the aggregate output.
+    /// The symbol is specified if it ended with this sample in the M-ary mode.
+    Result advance(const std::optional<std::uint32_t> symbol)
+    {
+        float data = 0.0F;
+        float clock = 0.0F;
+        if (tracking_)
+        {
+            for (const auto index : {getEarlyIndex(), prompt_, getLateIndex()})
+            {
+                const auto res = channels_[index].getResult(getPosition(index));
+                data  += static_cast<float>(vote(res.data, res.weight));
+                clock += static_cast<float>(vote(res.clock, res.weight));
+            }
+        }
+        else
+        {
+            updateAggregate();
+            data  = static_cast<float>(data_sum_);
+            clock = static_cast<float>(clock_sum_);
+        }
+        // The channels roll over in the descending order of their indexes, so the late channel is the last one.
+        // In the M-ary mode, the tracking loop is updated by the symbol detector instead.
+        if (tracking_)
+        {
+            if (!IsMAry && (sample_count_ > 0) && (getRolloverIndex() == getLateIndex()))
+            {
+                updateTracking(channels_[getEarlyIndex()].getCorrelation(),
+                               channels_[prompt_].getCorrelation(),
+                               channels_[getLateIndex()].getCorrelation());
+            }
+        }
+        else if (phase_ == 0)
+        {
+            updateAcquisition();
+        }
+        phase_ = (phase_ + 1U) % SequenceLength;
+        sample_count_++;
+        if (IsMAry && tracking_)
+        {
+            // The binary outputs are meaningless while the symbols are detected because the code is shifted.
+            return {
+                0.0F,
+                0.0F,
+                symbol.value_or(0U),
+                static_cast<std::uint8_t>(symbol ? SymbolBits : 0U)
+            };
+        }
+        return {
+            data,
+            clock
+        };
+    }
+
+    using Channel = CorrelationChannel<SequenceLength>;
+
+    std::vector<Channel> channels_;
+    Bits code_{};
+    std::vector<float> code_signs_;     ///< Soft decision only.
+    History history_{};
+    std::uint32_t history_head_ = 0;    ///< Soft decision only: the index of the oldest sample.
+    std::uint32_t phase_ = 0;           ///< The number of samples fed so far modulo the sequence length.
+    std::uint64_t sample_count_ = 0;
+
+    bool          tracking_ = false;
+    std::uint32_t prompt_ = 0;
+    std::uint32_t acquisition_count_ = 0;
+    std::uint32_t loss_count_ = 0;
+    float         loss_threshold_ = 0.0F;
+    float         noise_floor_ = 0.0F;
+
+    /// Fast acquisition only; see updateFastAcquisition().
+    std::vector<float> code_chips_;
+    std::array<float, FastAcquisitionWindow / Oversampling> coarse_chips_{};
+    std::array<float, Code::Length> coarse_correlation_{};
+    std::uint32_t fast_acquisition_candidate_ = 0;
+    std::uint32_t fast_acquisition_count_ = 0;
+    float         dll_accumulator_ = 0.0F;
+    float         phase_error_ = 0.0F;
+    double        rate_integrator_ = 0.0;
+
+    /// The aggregate output of the acquisition; see updateAggregate().
+    double data_sum_ = 0.0;
+    double clock_sum_ = 0.0;
+    bool   aggregate_valid_ = false;
+
+    FFT fft_;
+    std::vector<std::complex<double>> fft_buffer_;
+    std::vector<std::complex<double>> code_spectrum_;
+    std::vector<std::complex<double>> symbol_buffer_;   ///< M-ary only.
+    std::uint64_t last_symbol_sample_ = 0;
+};
+
+}
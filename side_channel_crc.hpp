@@ -0,0 +1,252 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// CRC algorithms used for the frame integrity check. CRC-16-CCITT is used by default; CRC-32C is preferred for
+/// large packets where a 16-bit CRC is too weak. Both are table-driven (slicing-by-8); CRC-32C also uses the
+/// dedicated CPU instructions where available (SSE4.2 on x86, the CRC extension on ARMv8).
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#if defined(__SSE4_2__)
+#   include <nmmintrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#   include <arm_acle.h>
+#endif
+
+namespace side_channel::crc
+{
+
+/// The CRC algorithm is recorded in the frame header; these values are transmitted over the wire.
+enum class Kind : std::uint8_t
+{
+    CRC16CCITT = 0,
+    CRC32C     = 1,
+};
+
+namespace detail
+{
+
+using CRC16Tables = std::array<std::array<std::uint16_t, 256>, 8>;
+using CRC32Tables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+/// The K-th table is the CRC of the byte followed by K zero bytes, which enables slicing-by-8.
+constexpr CRC16Tables makeCRC16CCITTTables()
+{
+    CRC16Tables out{};
+    for (auto i = 0U; i < 256U; i++)
+    {
+        auto x = static_cast<std::uint16_t>(i << 8U);
+        for (auto j = 0U; j < 8U; j++)
+        {
+            x = static_cast<std::uint16_t>((x << 1U) ^ (((x & 0x8000U) != 0U) ? 0x1021U : 0U));
+        }
+        out[0][i] = x;
+    }
+    for (auto k = 1U; k < 8U; k++)
+    {
+        for (auto i = 0U; i < 256U; i++)
+        {
+            const auto prev = out[k - 1U][i];
+            out[k][i] = static_cast<std::uint16_t>((prev << 8U) ^ out[0][prev >> 8U]);
+        }
+    }
+    return out;
+}
+
+/// Same as above for the reflected CRC-32C.
+constexpr CRC32Tables makeCRC32CTables()
+{
+    CRC32Tables out{};
+    for (auto i = 0U; i < 256U; i++)
+    {
+        std::uint32_t x = i;
+        for (auto j = 0U; j < 8U; j++)
+        {
+            x = (x >> 1U) ^ (((x & 1U) != 0U) ? 0x82F63B78U : 0U);
+        }
+        out[0][i] = x;
+    }
+    for (auto k = 1U; k < 8U; k++)
+    {
+        for (auto i = 0U; i < 256U; i++)
+        {
+            const auto prev = out[k - 1U][i];
+            out[k][i] = (prev >> 8U) ^ out[0][prev & 0xFFU];
+        }
+    }
+    return out;
+}
+
+inline constexpr CRC16Tables CRC16CCITTTable = makeCRC16CCITTTables();
+inline constexpr CRC32Tables CRC32CTable     = makeCRC32CTables();
+
+}
+
+/// CRC-16-CCITT (a.k.a. CRC-16/CCITT-FALSE): polynomial 0x1021, initial value 0xFFFF, no reflection, no output XOR.
+class CRC16CCITT
+{
+public:
+    static constexpr std::size_t Size = 2;
+
+    void add(const std::uint8_t* data, std::size_t size)
+    {
+        while (size >= 8U)
+        {
+            value_ = static_cast<std::uint16_t>(Table[7][data[0] ^ (value_ >> 8U)] ^
+                                                Table[6][data[1] ^ (value_ & 0xFFU)] ^
+                                                Table[5][data[2]] ^
+                                                Table[4][data[3]] ^
+                                                Table[3][data[4]] ^
+                                                Table[2][data[5]] ^
+                                                Table[1][data[6]] ^
+                                                Table[0][data[7]]);
+            data += 8U;
+            size -= 8U;
+        }
+        while (size --> 0U)
+        {
+            value_ = static_cast<std::uint16_t>((value_ << 8U) ^ Table[0][*data++ ^ (value_ >> 8U)]);
+        }
+    }
+
+    std::uint16_t get() const { return value_; }
+
+    /// Big endian.
+    std::array<std::uint8_t, Size> getBytes() const
+    {
+        return {static_cast<std::uint8_t>(value_ >> 8U), static_cast<std::uint8_t>(value_)};
+    }
+
+private:
+    static constexpr const auto& Table = detail::CRC16CCITTTable;
+
+    std::uint16_t value_ = 0xFFFFU;
+};
+
+/// CRC-32C (Castagnoli): reflected polynomial 0x82F63B78, initial value and output XOR 0xFFFFFFFF.
+class CRC32C
+{
+public:
+    static constexpr std::size_t Size = 4;
+
+    void add(const std::uint8_t* data, std::size_t size)
+    {
+#if defined(__SSE4_2__) && defined(__x86_64__)
+        std::uint64_t v = value_;
+        while (size >= 8U)
+        {
+            std::uint64_t word = 0;
+            __builtin_memcpy(&word, data, 8U);
+            v = _mm_crc32_u64(v, word);
+            data += 8U;
+            size -= 8U;
+        }
+        value_ = static_cast<std::uint32_t>(v);
+        while (size --> 0U)
+        {
+            value_ = _mm_crc32_u8(value_, *data++);
+        }
+#elif defined(__ARM_FEATURE_CRC32)
+        while (size >= 8U)
+        {
+            std::uint64_t word = 0;
+            __builtin_memcpy(&word, data, 8U);
+            value_ = __crc32cd(value_, word);
+            data += 8U;
+            size -= 8U;
+        }
+        while (size --> 0U)
+        {
+            value_ = __crc32cb(value_, *data++);
+        }
+#else
+        while (size >= 8U)
+        {
+            value_ = Table[7][(data[0] ^ value_) & 0xFFU] ^
+                     Table[6][(data[1] ^ (value_ >> 8U)) & 0xFFU] ^
+                     Table[5][(data[2] ^ (value_ >> 16U)) & 0xFFU] ^
+                     Table[4][data[3] ^ (value_ >> 24U)] ^
+                     Table[3][data[4]] ^
+                     Table[2][data[5]] ^
+                     Table[1][data[6]] ^
+                     Table[0][data[7]];
+            data += 8U;
+            size -= 8U;
+        }
+        while (size --> 0U)
+        {
+            value_ = (value_ >> 8U) ^ Table[0][(*data++ ^ value_) & 0xFFU];
+        }
+#endif
+    }
+
+    std::uint32_t get() const { return value_ ^ 0xFFFFFFFFU; }
+
+    /// Big endian, like CRC-16-CCITT, to keep the frame format uniform.
+    std::array<std::uint8_t, Size> getBytes() const
+    {
+        const auto x = get();
+        return {
+            static_cast<std::uint8_t>(x >> 24U),
+            static_cast<std::uint8_t>(x >> 16U),
+            static_cast<std::uint8_t>(x >> 8U),
+            static_cast<std::uint8_t>(x),
+        };
+    }
+
+private:
+    static constexpr const auto& Table = detail::CRC32CTable;
+
+    std::uint32_t value_ = 0xFFFFFFFFU;
+};
+
+/// The number of bytes that the CRC of the specified kind occupies in the frame.
+/// Empty if the kind is not known, e.g., if the frame header is damaged.
+inline std::optional<std::size_t> getSize(const Kind kind)
+{
+    switch (kind)
+    {
+    case Kind::CRC16CCITT: return CRC16CCITT::Size;
+    case Kind::CRC32C:     return CRC32C::Size;
+    }
+    return {};
+}
+
+/// Computes the CRC of the specified kind and returns it serialized for transmission.
+inline std::vector<std::uint8_t> compute(const Kind kind, const std::uint8_t* const data, const std::size_t size)
+{
+    if (kind == Kind::CRC32C)
+    {
+        CRC32C crc;
+        crc.add(data, size);
+        const auto bytes = crc.getBytes();
+        return {std::begin(bytes), std::end(bytes)};
+    }
+    CRC16CCITT crc;
+    crc.add(data, size);
+    const auto bytes = crc.getBytes();
+    return {std::begin(bytes), std::end(bytes)};
+}
+
+/// Returns true if the data is followed by its valid CRC of the specified kind.
+inline bool check(const Kind kind, const std::uint8_t* const data, const std::size_t size_with_crc)
+{
+    const auto crc_size = getSize(kind);
+    if (!crc_size || (size_with_crc < *crc_size))
+    {
+        return false;
+    }
+    const auto payload_size = size_with_crc - *crc_size;
+    const auto ref = compute(kind, data, payload_size);
+    return std::equal(std::begin(ref), std::end(ref), data + payload_size);
+}
+
+}
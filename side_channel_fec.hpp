@@ -0,0 +1,187 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Forward error correction of the frames: the rate 1/2 convolutional code of constraint length 7 with the
+/// generator polynomials 171 and 133 (octal), which is the de-facto standard code of deep-space and satellite links,
+/// decoded by a soft-decision Viterbi decoder. The code corrects scattered bit errors at the cost of twice the
+/// number of bits on the wire; at the bit rates of this link a burst of interference rarely spans more than
+/// one bit, so no interleaving is needed.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace side_channel::fec
+{
+
+/// The FEC kind is recorded in the frame header; these values are transmitted over the wire.
+enum class Kind : std::uint8_t
+{
+    None           = 0,
+    Convolutional  = 1,
+};
+
+namespace detail
+{
+
+static constexpr std::uint32_t ConstraintLength = 7;
+static constexpr std::uint32_t StateCount       = 1U << (ConstraintLength - 1U);
+static constexpr std::uint32_t TailBits         = ConstraintLength - 1U;
+static constexpr std::uint32_t PolynomialA      = 0171;
+static constexpr std::uint32_t PolynomialB      = 0133;
+
+/// The register contains the last ConstraintLength input bits, the newest one in the LSB.
+struct Output
+{
+    bool a;
+    bool b;
+};
+constexpr Output encodeStep(const std::uint32_t reg)
+{
+    return {(__builtin_parity(reg & PolynomialA) != 0), (__builtin_parity(reg & PolynomialB) != 0)};
+}
+
+}
+
+/// The encoded size in bytes of a payload of the specified size. The encoder is terminated with the tail bits
+/// that return it into the zero state, and the last byte is padded with zero bits.
+constexpr std::size_t getEncodedSize(const Kind kind, const std::size_t size)
+{
+    if (kind == Kind::Convolutional)
+    {
+        return ((((size * 8U) + detail::TailBits) * 2U) + 7U) / 8U;
+    }
+    return size;
+}
+
+/// The bits are encoded in the order of transmission: MSB first.
+inline std::vector<std::uint8_t> encode(const Kind kind, const std::uint8_t* const data, const std::size_t size)
+{
+    if (kind != Kind::Convolutional)
+    {
+        return {data, data + size};
+    }
+    std::vector<std::uint8_t> out(getEncodedSize(kind, size), 0);
+    std::size_t out_bit = 0;
+    const auto emit = [&out, &out_bit](const bool bit)
+    {
+        if (bit)
+        {
+            out[out_bit / 8U] |= static_cast<std::uint8_t>(0x80U >> (out_bit % 8U));
+        }
+        out_bit++;
+    };
+    std::uint32_t reg = 0;
+    const auto push = [&reg, &emit](const bool bit)
+    {
+        reg = ((reg << 1U) | (bit ? 1U : 0U)) & ((1U << detail::ConstraintLength) - 1U);
+        const auto o = detail::encodeStep(reg);
+        emit(o.a);
+        emit(o.b);
+    };
+    for (std::size_t i = 0; i < size; i++)
+    {
+        for (auto k = 8U; k --> 0U;)
+        {
+            push(((data[i] >> k) & 1U) != 0U);
+        }
+    }
+    for (auto i = 0U; i < detail::TailBits; i++)
+    {
+        push(false);
+    }
+    return out;
+}
+
+/// Decodes the payload from the soft bits of the encoded bytes, MSB first: positive if the bit is likely one,
+/// and the magnitude is the confidence; the scale is arbitrary but shall be the same for all bits of the frame.
+/// The paths are scored by their correlation with the soft bits, which is the maximum likelihood metric for
+/// Gaussian noise. Empty if the size cannot be the encoded size of any payload.
+inline std::optional<std::vector<std::uint8_t>> decode(const Kind         kind,
+                                                       const float* const soft,
+                                                       const std::size_t  bit_count)
+{
+    if (kind == Kind::None)
+    {
+        if ((bit_count % 8U) != 0U)
+        {
+            return {};
+        }
+        std::vector<std::uint8_t> out(bit_count / 8U, 0);
+        for (std::size_t i = 0; i < bit_count; i++)
+        {
+            out[i / 8U] |= static_cast<std::uint8_t>((soft[i] > 0.0F) ? (0x80U >> (i % 8U)) : 0U);
+        }
+        return out;
+    }
+    if (kind != Kind::Convolutional)
+    {
+        return {};
+    }
+    const std::size_t byte_count = bit_count / 8U;
+    if (((bit_count % 8U) != 0U) || (byte_count < 2U) || ((byte_count % 2U) != 0U))
+    {
+        return {};
+    }
+    const std::size_t size = (byte_count - 2U) / 2U;
+    if (getEncodedSize(kind, size) != byte_count)
+    {
+        return {};
+    }
+    const std::size_t step_count = (size * 8U) + detail::TailBits;
+
+    // The decision of each step is the MSB of the predecessor of each state, one bit per state.
+    static_assert(detail::StateCount == 64U);
+    std::vector<std::uint64_t> decisions(step_count, 0);
+    constexpr float Unreachable = -std::numeric_limits<float>::infinity();
+    std::array<float, detail::StateCount> metric{};
+    metric.fill(Unreachable);
+    metric[0] = 0.0F;
+    for (std::size_t t = 0; t < step_count; t++)
+    {
+        const float ra = soft[t * 2U];
+        const float rb = soft[(t * 2U) + 1U];
+        std::array<float, detail::StateCount> next{};
+        std::uint64_t decision = 0;
+        for (auto state = 0U; state < detail::StateCount; state++)
+        {
+            float best = Unreachable;
+            for (auto msb = 0U; msb < 2U; msb++)
+            {
+                const auto prev = (state >> 1U) | (msb << (detail::ConstraintLength - 2U));
+                const auto reg = (prev << 1U) | (state & 1U);
+                const auto o = detail::encodeStep(reg);
+                const float m = metric[prev] + (o.a ? ra : -ra) + (o.b ? rb : -rb);
+                if (m > best)
+                {
+                    best = m;
+                    decision = (msb != 0U) ? (decision | (1ULL << state)) : (decision & ~(1ULL << state));
+                }
+            }
+            next[state] = best;
+        }
+        metric = next;
+        decisions[t] = decision;
+    }
+
+    // The encoder is terminated in the zero state, so the traceback starts there.
+    std::vector<std::uint8_t> out(size, 0);
+    std::uint32_t state = 0;
+    for (std::size_t t = step_count; t --> 0U;)
+    {
+        if ((t < (size * 8U)) && ((state & 1U) != 0U))
+        {
+            out[t / 8U] |= static_cast<std::uint8_t>(0x80U >> (t % 8U));
+        }
+        const auto msb = static_cast<std::uint32_t>((decisions[t] >> state) & 1U);
+        state = (state >> 1U) | (msb << (detail::ConstraintLength - 2U));
+    }
+    return out;
+}
+
+}
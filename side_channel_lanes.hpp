@@ -0,0 +1,39 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Parallel lanes: the cores that the PHY loads or measures are partitioned into groups, each of which is
+/// an independent link with its own spread code, so that the aggregate throughput scales with the number of cores.
+/// The segments of a file are distributed over the lanes: segment K is sent over lane K%N
+/// (see side_channel_segment.hpp).
+/// This only works if the mapping of the cores of the transmitter and the receiver to the physical cores is stable.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include <vector>
+
+namespace side_channel::lanes
+{
+
+/// Core K belongs to lane K % lane_count. The transmitter and the receiver shall use the same lane count.
+/// Lane L uses the PRN number of the link plus L. The core count is that of the local host by default,
+/// or that of the recorder when a trace is replayed.
+inline std::vector<unsigned> getLaneCores(const unsigned lane,
+                                          const unsigned lane_count,
+                                          const unsigned core_count = getThreadCount())
+{
+    std::vector<unsigned> out;
+    for (auto core = lane; core < core_count; core += lane_count)
+    {
+        out.push_back(core);
+    }
+    return out;
+}
+
+/// Each lane shall have at least one core of its own.
+inline bool isLaneCountValid(const unsigned lane_count)
+{
+    return (lane_count >= 1U) && (lane_count <= getThreadCount());
+}
+
+}
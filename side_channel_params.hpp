@@ -4,87 +4,615 @@
 #pragma once
 
 #include <chrono>
-#include <bitset>
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <variant>
+#include <vector>
+#include <type_traits>
+#include "side_channel_code.hpp"
+#include "side_channel_topology.hpp"
 
-/// The transmitter can modulate load on all available cores to traverse virtualization boundaries that implement
-/// non-direct CPU core mapping (e.g., virtual core X may be mapped to physical core Y such that X!=Y).
-/// This is usually not necessary outside of virtualized environments, in which case only 0th core should be used.
-#ifndef MAX_CONCURRENCY
-#   define MAX_CONCURRENCY 999
+/// The CPU cycle counter is much cheaper to read than std::chrono::steady_clock, especially in virtual machines
+/// where clock_gettime() may not be serviced by the vDSO. Set to zero to always use std::chrono::steady_clock.
+#ifndef USE_CYCLE_COUNTER
+#   define USE_CYCLE_COUNTER 1
 #endif
 
-#if MAX_CONCURRENCY == 1
-#include <pthread.h>
+#if USE_CYCLE_COUNTER && defined(__x86_64__)
+#   include <x86intrin.h>
+#   include <cpuid.h>
 #endif
 
 namespace side_channel
 {
 
-inline void initThread()
+/// Binds the calling thread to the specified CPU core. Returns false if the affinity could not be set.
+inline bool pinThread(const unsigned core)
 {
-#if MAX_CONCURRENCY == 1
-    // Force affinity with the 0th core.
     cpu_set_t cpuset{};
     CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);
-    (void)pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-#endif
+    CPU_SET(core, &cpuset);
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+/// The execution profile of the PHY threads, which are the load generators of the transmitter, the counters and
+/// the sampler of the receiver, and the threads that drive the lanes. It is selected at runtime by the command line
+/// options; see parseExecutionOption(). By default, the PHY runs on one hardware thread per physical core of the
+/// largest cache domain (see side_channel_topology.hpp) at the normal priority.
+struct ExecutionProfile
+{
+    /// The PHY core K (see side_channel_lanes.hpp) runs on cpus[K], so that the PHY can be confined to the CPUs
+    /// isolated from the background processes (e.g., via isolcpus or cpusets). If empty, the CPUs are selected
+    /// according to the placement when the profile is applied.
+    std::vector<unsigned> cpus;
+    /// The transmitter can modulate load on all available cores to traverse virtualization boundaries that implement
+    /// non-direct CPU core mapping (e.g., virtual core X may be mapped to physical core Y such that X!=Y); that is
+    /// what Placement::All is for. This is usually not necessary outside of virtualized environments, where
+    /// the whole cache domain couples best, or even only the 0th core (max_cores=1). Empty if the CPUs are explicit.
+    std::optional<topology::Placement> placement = topology::Placement::CacheDomain;
+    std::size_t max_cores = SIZE_MAX;
+    /// SCHED_FIFO or SCHED_RR puts the PHY threads ahead of the processes of the normal priority on their CPUs,
+    /// which would otherwise delay the chip edges and the sampling windows. Beware that the counters of the receiver
+    /// spin all the time, so only the real-time throttling of the kernel leaves their CPUs to anything else.
+    int policy = SCHED_OTHER;
+    int priority = 0;
+    /// Locks all present and future pages of the process in memory to avoid the page faults in the PHY loops.
+    bool lock_memory = false;
+};
+
+static constexpr int DefaultRealTimePriority = 10;
+
+namespace detail
+{
+inline ExecutionProfile& getExecutionProfileStorage()
+{
+    static ExecutionProfile profile;
+    return profile;
+}
+
+/// The PHY threads report the first failure only; the rest are likely to fail the same way.
+inline void reportThreadFailure(const char* const what, const int error)
+{
+    static std::atomic<bool> reported{false};
+    if (!reported.exchange(true))
+    {
+        std::fprintf(stderr, "WARNING: Could not %s of a PHY thread: %s\n", what, std::strerror(error));
+    }
+}
+}
+
+/// Not thread-safe with respect to applyExecutionProfile().
+inline const ExecutionProfile& getExecutionProfile()
+{
+    return detail::getExecutionProfileStorage();
+}
+
+/// The number of cores that the PHY is allowed to load or measure.
+inline unsigned getThreadCount()
+{
+    const auto& cpus = getExecutionProfile().cpus;
+    const auto count = cpus.empty() ? std::thread::hardware_concurrency() : static_cast<unsigned>(cpus.size());
+    return std::max<unsigned>(1, count);
+}
+
+/// The CPU that the specified PHY core runs on. Before the profile is applied, the PHY core K runs on the CPU K.
+inline unsigned getCPU(const unsigned core)
+{
+    const auto& cpus = getExecutionProfile().cpus;
+    return cpus.empty() ? (core % std::max(1U, std::thread::hardware_concurrency())) : cpus.at(core % cpus.size());
 }
 
-static constexpr std::uint16_t CRCInitial = 0xFFFFU;
+/// Configures the calling PHY thread according to the execution profile: binds it to the CPU of the specified
+/// PHY core if any, and applies the scheduling policy. If there is only one PHY core, the thread is bound to it
+/// in any case, because it is going to do the counting itself (see rx::readPHY()).
+inline void initThread(std::optional<unsigned> core = {})
+{
+    if (!core && (getThreadCount() == 1U))
+    {
+        core = 0;
+    }
+    if (core && !pinThread(getCPU(*core)))
+    {
+        detail::reportThreadFailure("set the CPU affinity", EINVAL);
+    }
+    const auto& profile = getExecutionProfile();
+    if (profile.policy != SCHED_OTHER)
+    {
+        sched_param param{};
+        param.sched_priority = profile.priority;
+        if (const auto error = pthread_setschedparam(pthread_self(), profile.policy, &param); error != 0)
+        {
+            detail::reportThreadFailure("set the scheduling policy", error);
+        }
+    }
+}
 
-// Naive implementation of CRC-16-CCITT
-// Taken from https://github.com/UAVCAN/libcanard
-inline std::uint16_t crcAdd(const std::uint16_t crc, const uint8_t byte)
+/// Parses the options of the execution profile: --cpus=LIST (e.g., 0,2,4-7) or --placement=all|cores|domain,
+/// --max-cores=N, --sched=fifo|rr|other[:PRIORITY], and --mlock. Returns false if the argument is not one of them;
+/// throws std::invalid_argument if it is malformed.
+inline bool parseExecutionOption(const std::string& arg, ExecutionProfile& profile)
 {
-    static constexpr std::uint16_t Top  = 0x8000U;
-    static constexpr std::uint16_t Poly = 0x1021U;
-    std::uint16_t out  = crc ^ (std::uint16_t)((std::uint16_t)(byte) << 8);
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
-    out = (std::uint16_t)((std::uint16_t)(out << 1U) ^ (((out & Top) != 0U) ? Poly : 0U));
+    if (arg.rfind("--cpus=", 0) == 0)
+    {
+        profile.cpus = topology::parseCPUList(arg.substr(7));
+        profile.placement.reset();
+        if (profile.cpus.empty())
+        {
+            throw std::invalid_argument("The CPU list is empty");
+        }
+        return true;
+    }
+    if (arg.rfind("--placement=", 0) == 0)
+    {
+        profile.placement = topology::findPlacement(arg.substr(12));
+        if (!profile.placement)
+        {
+            throw std::invalid_argument("Unknown placement " + arg.substr(12));
+        }
+        profile.cpus.clear();
+        return true;
+    }
+    if (arg.rfind("--max-cores=", 0) == 0)
+    {
+        profile.max_cores = std::stoul(arg.substr(12));
+        if (profile.max_cores == 0U)
+        {
+            throw std::invalid_argument("At least one core is needed");
+        }
+        return true;
+    }
+    if (arg.rfind("--sched=", 0) == 0)
+    {
+        const auto value = arg.substr(8);
+        const auto colon = value.find(':');
+        const auto name = value.substr(0, colon);
+        if (name == "fifo")
+        {
+            profile.policy = SCHED_FIFO;
+        }
+        else if (name == "rr")
+        {
+            profile.policy = SCHED_RR;
+        }
+        else if (name == "other")
+        {
+            profile.policy = SCHED_OTHER;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown scheduling policy " + name);
+        }
+        const auto default_priority = (profile.policy == SCHED_OTHER) ? 0 : DefaultRealTimePriority;
+        profile.priority = (colon == std::string::npos) ? default_priority : std::stoi(value.substr(colon + 1));
+        return true;
+    }
+    if (arg == "--mlock")
+    {
+        profile.lock_memory = true;
+        return true;
+    }
+    return false;
+}
+
+/// The usage of the options accepted by parseExecutionOption().
+static constexpr const char* ExecutionOptionUsage =
+    "[--cpus=LIST|--placement=all|cores|domain] [--max-cores=N] [--sched=fifo|rr[:PRIORITY]] [--mlock]";
+
+/// For the diagnostics.
+inline std::string describeExecutionProfile(const ExecutionProfile& profile)
+{
+    std::string out = "cpus=";
+    for (std::size_t i = 0; i < profile.cpus.size(); i++)
+    {
+        out += ((i > 0) ? "," : "") + std::to_string(profile.cpus[i]);
+    }
+    out += " placement=";
+    out += profile.placement ? topology::getPlacementName(*profile.placement) : "explicit";
+    const char* const policy =
+        (profile.policy == SCHED_FIFO) ? "fifo" : ((profile.policy == SCHED_RR) ? "rr" : "other");
+    out += std::string(" sched=") + policy + ":" + std::to_string(profile.priority);
+    out += profile.lock_memory ? " mlock" : "";
     return out;
 }
 
+/// Makes the execution profile effective for the PHY threads started afterwards; this shall be done before
+/// the PHY is used. Unless the CPUs are explicit, they are selected according to the placement from the topology
+/// of the host (see side_channel_topology.hpp); either way, at most max_cores of them are used.
+/// The process-wide steps are performed at once: the memory is locked, and the scheduling
+/// policy is tried on the calling thread, which is then restored, so that the other threads do not inherit it.
+/// The CPUs that are not available to the process and the invalid priorities are rejected with
+/// std::invalid_argument. The steps that fail for the lack of privileges are returned as warnings and skipped,
+/// i.e., the PHY runs at the normal priority if SCHED_FIFO or SCHED_RR is not permitted.
+inline std::vector<std::string> applyExecutionProfile(ExecutionProfile profile)
+{
+    std::vector<std::string> warnings;
+    if (profile.placement)
+    {
+        profile.cpus = topology::selectCPUs(topology::getTopology(), *profile.placement, profile.max_cores);
+    }
+    profile.cpus.resize(std::min(profile.cpus.size(), profile.max_cores));
+    if (profile.cpus.empty())
+    {
+        throw std::invalid_argument("No CPUs are available to the PHY");
+    }
+    cpu_set_t available{};
+    CPU_ZERO(&available);
+    if (0 == sched_getaffinity(0, sizeof(available), &available))
+    {
+        for (auto cpu : profile.cpus)
+        {
+            if ((cpu >= CPU_SETSIZE) || !CPU_ISSET(cpu, &available))
+            {
+                throw std::invalid_argument("CPU " + std::to_string(cpu) + " is not available to the process");
+            }
+        }
+    }
+    if ((profile.priority < sched_get_priority_min(profile.policy)) ||
+        (profile.priority > sched_get_priority_max(profile.policy)))
+    {
+        throw std::invalid_argument("The priority " + std::to_string(profile.priority) +
+                                    " is out of range for the scheduling policy");
+    }
+    if (profile.policy != SCHED_OTHER)
+    {
+        int old_policy = SCHED_OTHER;
+        sched_param old_param{};
+        (void)pthread_getschedparam(pthread_self(), &old_policy, &old_param);
+        sched_param param{};
+        param.sched_priority = profile.priority;
+        if (const auto error = pthread_setschedparam(pthread_self(), profile.policy, &param); error != 0)
+        {
+            warnings.push_back(std::string("Could not set the real-time scheduling policy, using the normal one: ") +
+                               std::strerror(error));
+            profile.policy = SCHED_OTHER;
+            profile.priority = 0;
+        }
+        (void)pthread_setschedparam(pthread_self(), old_policy, &old_param);
+    }
+    if (profile.lock_memory && (0 != mlockall(MCL_CURRENT | MCL_FUTURE)))
+    {
+        warnings.push_back(std::string("Could not lock the memory: ") + std::strerror(errno));
+        profile.lock_memory = false;
+    }
+    detail::getExecutionProfileStorage() = std::move(profile);
+    return warnings;
+}
+
+/// A monotonic clock compatible with std::chrono that is backed by the CPU cycle counter: the invariant TSC on x86 or
+/// the virtual counter CNTVCT_EL0 on ARM. The counter is calibrated against std::chrono::steady_clock once at
+/// the first use, which takes a fraction of a second. If the counter is unavailable or not invariant,
+/// std::chrono::steady_clock is used instead. Both the TX and the RX use this clock for deadlines and for counting.
+class FastClock
+{
+public:
+    using duration   = std::chrono::nanoseconds;
+    using rep        = duration::rep;
+    using period     = duration::period;
+    using time_point = std::chrono::time_point<FastClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept
+    {
+        const auto& cal = getCalibration();
+        if (cal.enabled)
+        {
+            const auto delta = static_cast<std::int64_t>(readCounter() - cal.base_ticks);
+            const auto delta_ns = (static_cast<__int128>(delta) * cal.ns_per_tick_q32) >> 32U;
+            return time_point(duration(cal.base_ns + static_cast<std::int64_t>(delta_ns)));
+        }
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()));
+    }
+
+    /// Human-readable name of the underlying time source for diagnostics.
+    static const char* getSourceName()
+    {
+        if (getCalibration().enabled)
+        {
+#if defined(__x86_64__)
+            return "TSC";
+#else
+            return "CNTVCT_EL0";
+#endif
+        }
+        return "steady_clock";
+    }
+
+private:
+    struct Calibration
+    {
+        bool enabled = false;
+        std::uint64_t base_ticks = 0;
+        std::int64_t base_ns = 0;
+        std::int64_t ns_per_tick_q32 = 0;   ///< Fixed point Q32.32.
+    };
+
+    static const Calibration& getCalibration()
+    {
+        static const Calibration cal = calibrate();
+        return cal;
+    }
+
+    static bool isCounterUsable()
+    {
+#if USE_CYCLE_COUNTER && defined(__x86_64__)
+        // The TSC is only usable as a clock if its rate is invariant across P-states and C-states.
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        return (0 != __get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx)) && ((edx & (1U << 8U)) != 0);
+#elif USE_CYCLE_COUNTER && defined(__aarch64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static std::uint64_t readCounter() noexcept
+    {
+#if USE_CYCLE_COUNTER && defined(__x86_64__)
+        return __rdtsc();
+#elif USE_CYCLE_COUNTER && defined(__aarch64__)
+        std::uint64_t out = 0;
+        asm volatile("isb; mrs %0, cntvct_el0" : "=r"(out) :: "memory");
+        return out;
+#else
+        return 0;
+#endif
+    }
+
+    /// Samples the counter together with the reference clock. The tightest bracket out of several attempts is used
+    /// to reduce the effect of preemption and of the reference clock read latency.
+    static std::pair<std::uint64_t, std::int64_t> sampleReference()
+    {
+        std::pair<std::uint64_t, std::int64_t> out{};
+        auto best_width = UINT64_MAX;
+        for (auto i = 0U; i < 100U; i++)
+        {
+            const auto a = readCounter();
+            const auto ref = std::chrono::steady_clock::now().time_since_epoch();
+            const auto b = readCounter();
+            if ((b - a) < best_width)
+            {
+                best_width = b - a;
+                out = {a + ((b - a) / 2U), std::chrono::duration_cast<duration>(ref).count()};
+            }
+        }
+        return out;
+    }
+
+    static Calibration calibrate()
+    {
+        Calibration out;
+        if (isCounterUsable())
+        {
+            const auto [ticks_a, ns_a] = sampleReference();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const auto [ticks_b, ns_b] = sampleReference();
+            if ((ticks_b > ticks_a) && (ns_b > ns_a))
+            {
+                out.enabled = true;
+                out.base_ticks = ticks_b;
+                out.base_ns = ns_b;
+                out.ns_per_tick_q32 = static_cast<std::int64_t>((static_cast<__int128>(ns_b - ns_a) << 32U) /
+                                                                (ticks_b - ticks_a));
+            }
+        }
+        return out;
+    }
+};
+
+/// Blocks the calling thread while the word contains the expected value. Spurious wakeups are possible.
+/// This is used for parking worker threads without burning CPU time, which would interfere with the PHY.
+inline void futexWait(const std::atomic<std::uint32_t>& word, const std::uint32_t expected)
+{
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+    (void)syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+/// Wakes up all threads blocked in futexWait() on the specified word.
+inline void futexWakeAll(std::atomic<std::uint32_t>& word)
+{
+    (void)syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
 namespace params
 {
 
-/// One chip of the raw signal takes this much time to transmit.
+/// The receiver samples the PHY at the chip rate of the fastest profile; the chip periods of all profiles shall be
+/// multiples of this value, and the slower profiles integrate several base chip periods per sample.
+static constexpr std::chrono::nanoseconds BaseChipPeriod{1'000'000};
+
+/// Each frame is preceded by the preamble of zero bits that allows the receiver to acquire the code phase before
+/// the frame begins; its length is specified in code periods (symbols) because the receiver needs that many to
+/// acquire the code phase regardless of the number of bits per symbol. Frames sent back-to-back using the same
+/// profile can use a shorter preamble because the receiver remains locked. The frame is followed by a short
+/// postamble that lets the receiver flush the last bits out of its correlator.
+static constexpr std::uint32_t PreambleLength = 20;
+static constexpr std::uint32_t PostambleLength = 2;
+
+/// The frame begins with the sync word, which is chosen such that its Hamming distance from any of its shifts
+/// preceded by the preamble is at least 9 bits, so a few bit errors can be tolerated.
+/// The sync word is followed by the frame header protected by its own CRC (see FrameType), and the body.
+static constexpr std::uint32_t SyncWord = 0xEB62U;
+static constexpr std::uint32_t SyncWordLength = 16;
+static constexpr std::uint32_t SyncWordMaxBitErrors = 2;
+/// The header byte, the size of the body in bytes (16 bits, big endian), and the CRC-16-CCITT of both.
+static constexpr std::uint32_t FrameHeaderSize = 5;
+static constexpr std::size_t   MaxFrameBodySize = 0xFFFFU;
+
+/// A link profile defines the family of the pseudorandom CDMA spread codes and the chip period.
+/// Each TX/RX pair uses a distinct member of the code family selected by the PRN number; different PRN numbers
+/// yield nearly orthogonal codes, so that multiple links can coexist on the same host.
+/// The codes are generated at compile time; the correlator and the transmitter are specialized on the code type.
+///
+/// One chip of the raw signal takes ChipPeriod to transmit.
 /// Accurate timing is absolutely essential for reliability of the data link.
 /// It is possible to go as low as 1 millisecond and possibly lower, resulting in very high throughput,
 /// although it does make the data link somewhat unstable outside of ideal conditions.
 /// Values ca. 100 ms enable robust communication under adverse conditions.
 /// Increasing the spread code length also improves the SNR.
-static constexpr std::chrono::nanoseconds ChipPeriod{16'000'000};
-
-/// The pseudorandom CDMA spread code unique to this TX/RX pair.
-/// In this example we use a subsequence of the 1023-bit Gold code for GPS SV#1.
-/// Helpful resource: https://natronics.github.io/blag/2014/gps-prn/
-static constexpr auto CDMACodeLength = 1023U;
-static std::bitset<CDMACodeLength> CDMACode(
-    "1100100000111001010010011110010100010011111010101101000100010101"
-    "0101100100011110100111111011011100110111110010101010000100000000"
-    "1110101001000100110111100000111101011100110011110110000000101111"
-    "0011111010100110001011011100011011110101000101011000001000000001"
-    "0000001100011101100000011100011011111111101001110100101101100001"
-    "0101011000100111001011011101100011101110111100001101100001100100"
-    "1001000001101101001011011110001011100000010100100111111000001010"
-    "1011100111110101111100110011000111000110110101010110110001101110"
-    "1110000000000010110011011001110110100000101010111010111010010100"
-    "0111001110001001010001010010110100001010110110101101100011100111"
-    "1011001000011111100101101000100001111101010111001100100100100101"
-    "1111111110000111110111100011011100101100001110010101000010100101"
-    "0111111000111101101001110110011111101111101000110001111100000001"
-    "0010100010110100010001001101100000011101101000110100010010001110"
-    "0010110011001001111001101111110011001010011010011010111100110110"
-    "101001110111100011010100010000100010010011100001110010100010000"
-);
+///
+/// If ShiftBits is zero, each code period carries one bit as the polarity of the code (binary phase-shift keying).
+/// Otherwise, M-ary code-shift keying is used: each code period carries ShiftBits+1 bits, where the first bit is
+/// the polarity and the remaining bits (MSB first) select one of 2^ShiftBits cyclic shifts of the code,
+/// spaced ShiftSpacing chips apart. The receiver picks the shift of maximum correlation once per code period,
+/// which multiplies the throughput without shortening the chip.
+template <typename Family_, std::int64_t ChipPeriodNanoseconds, std::uint32_t ShiftBits_ = 0>
+struct LinkProfile
+{
+    using Family = Family_;
+    using Code = typename Family::Code;
+
+    static constexpr std::chrono::nanoseconds ChipPeriod{ChipPeriodNanoseconds};
+    static constexpr auto CodeLength = Code::Length;
+    /// One symbol takes one full code period to transmit.
+    static constexpr std::chrono::nanoseconds SymbolPeriod = ChipPeriod * CodeLength;
+
+    static constexpr std::uint32_t ShiftBits = ShiftBits_;
+    static constexpr std::uint32_t SymbolBits = ShiftBits + 1U;
+    static constexpr std::uint32_t ShiftSpacing = CodeLength >> ShiftBits;
+    static_assert(ShiftSpacing >= ((ShiftBits > 0) ? 2U : 1U), "The shifts shall be resolvable by the correlator");
+
+    static_assert((ChipPeriod.count() % BaseChipPeriod.count()) == 0);
+    /// The number of base chip periods per chip of this profile.
+    static constexpr auto Decimation = static_cast<std::uint32_t>(ChipPeriod.count() / BaseChipPeriod.count());
+
+    /// Returns the spread code for the specified PRN number in [1, Family::PRNCount].
+    static const Code& getCode(const unsigned prn)
+    {
+        static constexpr auto table = Family::makeTable();
+        if ((prn < 1) || (prn > Family::PRNCount))
+        {
+            throw std::invalid_argument("PRN shall be in [1, " + std::to_string(Family::PRNCount) + "]: " +
+                                        std::to_string(prn));
+        }
+        return table[prn - 1U];
+    }
+
+    /// The time it takes to transmit a burst of frames with the bodies of the specified total size including
+    /// the preamble of the specified length in symbols and the postamble.
+    static constexpr std::chrono::nanoseconds getFrameDuration(const std::size_t    body_size,
+                                                               const std::uint32_t preamble_length,
+                                                               const std::size_t    frame_count = 1)
+    {
+        const auto bits = (frame_count * (SyncWordLength + (FrameHeaderSize * 8U))) + (body_size * 8U);
+        const auto symbols = preamble_length + ((bits + SymbolBits - 1U) / SymbolBits) + PostambleLength;
+        return SymbolPeriod * static_cast<std::int64_t>(symbols);
+    }
+};
+
+/// The 1023-chip GPS C/A code at 16 ms per chip is robust enough to traverse virtualization boundaries.
+/// This is the default profile, and also the one that the other profiles are announced with.
+struct RobustProfile : LinkProfile<code::GPSCA, 16'000'000>
+{
+    static constexpr const char* Name = "robust";
+};
+/// Processes on the same host that are not pinned to the same core.
+struct SameHostProfile : LinkProfile<code::Kasami255, 2'000'000>
+{
+    static constexpr const char* Name = "host";
+};
+/// Processes pinned to the same core.
+struct SameCoreProfile : LinkProfile<code::Gold63, 1'000'000>
+{
+    static constexpr const char* Name = "core";
+};
+/// Same as the robust profile with 7 bits per code period: the polarity and one of 64 shifts spaced 15 chips apart.
+struct RobustMAryProfile : LinkProfile<code::GPSCA, 16'000'000, 6>
+{
+    static constexpr const char* Name = "robust-mary";
+};
+/// Same as the same-host profile with 6 bits per code period: the polarity and one of 32 shifts 7 chips apart.
+struct SameHostMAryProfile : LinkProfile<code::Kasami255, 2'000'000, 5>
+{
+    static constexpr const char* Name = "host-mary";
+};
+
+/// A runtime choice of a link profile. The index of the alternative is the profile ID transmitted over the wire.
+using Profile = std::variant<RobustProfile, SameHostProfile, SameCoreProfile, RobustMAryProfile, SameHostMAryProfile>;
+
+/// The ID of the specified profile type, which is its index in the variant.
+/// The robust profile is the default alternative.
+template <typename P, std::size_t Index = 0>
+constexpr std::uint8_t getProfileID()
+{
+    if constexpr (std::is_same_v<P, std::variant_alternative_t<Index, Profile>>)
+    {
+        return static_cast<std::uint8_t>(Index);
+    }
+    else
+    {
+        return getProfileID<P, Index + 1U>();
+    }
+}
+
+static_assert(getProfileID<RobustProfile>() == 0);
+
+namespace detail
+{
+template <std::size_t Index = 0, typename Predicate>
+std::optional<Profile> findProfileIf(const Predicate& predicate)
+{
+    if constexpr (Index < std::variant_size_v<Profile>)
+    {
+        using P = std::variant_alternative_t<Index, Profile>;
+        if (predicate(Index, std::string_view(P::Name)))
+        {
+            return Profile{std::in_place_index<Index>};
+        }
+        return findProfileIf<Index + 1U>(predicate);
+    }
+    else
+    {
+        return {};
+    }
+}
+}
+
+/// Empty if the ID is unknown, e.g., if received from a newer transmitter.
+inline std::optional<Profile> findProfile(const std::uint8_t id)
+{
+    return detail::findProfileIf([id](const std::size_t index, std::string_view) { return index == id; });
+}
+
+/// Empty if there is no profile with the specified name.
+inline std::optional<Profile> findProfile(const std::string_view name)
+{
+    return detail::findProfileIf([name](std::size_t, const std::string_view n) { return n == name; });
+}
+
+/// The first byte of every frame contains the CRC kind (see crc::Kind) in the bits 0-1, the FEC kind
+/// (see fec::Kind) in the bits 2-3, and the frame type in the upper nibble. The header byte itself is not encoded
+/// by the FEC; the rest of the frame, i.e., the body, is. The profile announcement is sent using the robust profile
+/// just before a data frame that is sent using the announced profile; its payload is the profile ID followed by
+/// the size of the body of the data frame in bytes (32 bits, big endian) and its preamble length in symbols,
+/// which allows the receiver to give up waiting if the data frame is lost.
+/// A segment frame carries one segment of a file; see side_channel_segment.hpp. The frames of a burst are announced
+/// at once: the announcement is followed by the number of frames in the burst (16 bits, big endian), and the size
+/// is the total size of their bodies.
+/// The poll and the acknowledgement frames implement the selective repeat ARQ; see side_channel_arq.hpp.
+enum class FrameType : std::uint8_t
+{
+    Data                 = 0,
+    ProfileAnnouncement  = 1,
+    Segment              = 2,
+    Poll                 = 3,
+    Ack                  = 4,
+};
 
 }
 }
@@ -0,0 +1,544 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The PHY of the receiver: the counter threads that measure the rate of the probe of the backend of the PHY
+/// (see side_channel_backend.hpp) in precisely timed windows,
+/// the sampler that distributes the measurements to the links through PHYSource, and the front end that turns them
+/// into the normalized samples of one link. The consumer of the measurements may either block on
+/// PHYSource::next() or poll them using PHYSource::poll(), e.g., from a foreign event loop.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_backend.hpp"
+#include "side_channel_trace.hpp"
+#include "side_channel_shm.hpp"
+#include "side_channel_telemetry.hpp"
+#include "side_channel_timer.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace side_channel::rx
+{
+
+static constexpr auto OversamplingFactor = 3;
+/// The sampler runs at the base chip rate; the samples of slower profiles are integrated from several measurements.
+static constexpr auto SampleDuration = side_channel::params::BaseChipPeriod / double(OversamplingFactor);
+static constexpr auto PHYAveragingFactor = 8;
+static constexpr auto PHYVarianceAveragingFactor = 64;
+/// If the sampler falls behind its deadline by more than this, the deadline is resynchronized; see readPHY().
+static constexpr auto MaxSamplerLag = std::chrono::seconds(1);
+/// Soft samples are clipped at this many standard deviations to limit the effect of impulsive noise.
+static constexpr float SoftSampleLimit = 4.0F;
+
+/// A persistent pool of counter threads, each pinned to its own core, that measure the ticks per unit time.
+/// The threads are started at the beginning of every sampling window by bumping the epoch counter rather than
+/// being spawned anew, which keeps the thread startup latency out of the measurement window.
+/// The ticks are the units of work of the probe of the backend.
+template <typename Backend>
+class CounterPool
+{
+public:
+    explicit CounterPool(const unsigned thread_count) :
+        slots_(thread_count)
+    {
+        for (auto i = 0U; i < thread_count; i++)
+        {
+            threads_.emplace_back([this, i]() { run(i); });
+        }
+    }
+
+    ~CounterPool()
+    {
+        stop_ = true;
+        epoch_.fetch_add(1, std::memory_order_release);
+        side_channel::futexWakeAll(epoch_);
+        for (auto& t : threads_)
+        {
+            t.join();
+        }
+    }
+
+    CounterPool(const CounterPool&) = delete;
+    CounterPool& operator=(const CounterPool&) = delete;
+
+    /// Runs all counters until the deadline and stores the count of each into the output, indexed by core.
+    void count(const side_channel::FastClock::time_point deadline, std::vector<std::int64_t>& out)
+    {
+        deadline_ = deadline;
+        pending_.store(static_cast<std::uint32_t>(slots_.size()), std::memory_order_relaxed);
+        epoch_.fetch_add(1, std::memory_order_release);
+        side_channel::futexWakeAll(epoch_);
+        for (;;)
+        {
+            const auto pending = pending_.load(std::memory_order_acquire);
+            if (pending == 0)
+            {
+                break;
+            }
+            side_channel::futexWait(pending_, pending);
+        }
+        out.resize(slots_.size());
+        for (std::size_t i = 0; i < slots_.size(); i++)
+        {
+            out[i] = slots_[i].count;
+        }
+    }
+
+private:
+    /// Each counter reports into its own cache line to avoid false sharing.
+    struct alignas(64) Slot
+    {
+        std::int64_t count = 0;
+    };
+
+    void run(const unsigned index)
+    {
+        side_channel::initThread(index);
+        typename Backend::Probe probe;
+        std::uint32_t epoch = 0;
+        for (;;)
+        {
+            for (;;)
+            {
+                const auto e = epoch_.load(std::memory_order_acquire);
+                if (e != epoch)
+                {
+                    epoch = e;
+                    break;
+                }
+                side_channel::futexWait(epoch_, epoch);
+            }
+            if (stop_)
+            {
+                break;
+            }
+            const auto deadline = deadline_;
+            std::int64_t cnt = 0;
+            probe.begin();
+            while (side_channel::FastClock::now() < deadline)
+            {
+                cnt += probe();
+            }
+            slots_[index].count = cnt;
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1U)
+            {
+                side_channel::futexWakeAll(pending_);
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<std::thread> threads_;
+    side_channel::FastClock::time_point deadline_;     ///< Published to the counters via the epoch.
+    bool stop_ = false;                                 ///< Published to the counters via the epoch.
+    alignas(64) std::atomic<std::uint32_t> epoch_{0};
+    alignas(64) std::atomic<std::uint32_t> pending_{0};
+};
+
+/// A raw measurement of the sampler timestamped at the end of its sampling window.
+struct PHYMeasurement
+{
+    side_channel::FastClock::time_point timestamp;
+    std::int64_t count = 0;         ///< The number of ticks counted during the window.
+    double elapsed_ns = 0.0;        ///< The actual duration of the window.
+};
+
+/// Blocks until the end of the next sampling window. The count of the returned measurement is the sum over all cores;
+/// the count of each core is stored separately into core_counts (indexed by core) for the parallel lanes.
+/// The rate correction is the estimated relative frequency error of the transmitter clock with respect to the local
+/// clock (positive if the transmitter is fast); the sampling windows are shortened or stretched accordingly
+/// to keep the samples aligned with the chips of the incoming signal.
+/// The timer accounts the delay of the end of each window after its deadline; the window is not slept through
+/// because the counting is the measurement.
+template <typename Backend = side_channel::backend::Default>
+PHYMeasurement readPHY(const double                         rate_correction,
+                              std::vector<std::int64_t>&           core_counts,
+                              side_channel::timer::PrecisionTimer& timer)
+{
+    // Use delta relative to fixed state to avoid accumulation of phase error, because phase error attenuates the
+    // useful signal at the receiver. The fractional part of the corrected step is carried over to the next window.
+    static auto deadline = side_channel::FastClock::now();
+    static double step_remainder_ns = 0.0;
+    step_remainder_ns += SampleDuration.count() / (1.0 + rate_correction);
+    const auto step_ns = std::floor(step_remainder_ns);
+    step_remainder_ns -= step_ns;
+    deadline += std::chrono::nanoseconds(static_cast<std::int64_t>(step_ns));
+    const auto started_at = side_channel::FastClock::now();
+    if ((started_at - deadline) > MaxSamplerLag)
+    {
+        // The sampler was not running, e.g., while the half-duplex link was transmitting. The lost windows cannot
+        // be recovered, so they are skipped instead of being caught up with a burst of empty windows.
+        deadline = started_at + std::chrono::nanoseconds(static_cast<std::int64_t>(step_ns));
+    }
+
+    // Run counter threads to measure ticks per unit time.
+    std::int64_t count = 0;
+    static const auto thread_count = side_channel::getThreadCount();
+    if (thread_count > 1U)
+    {
+        static CounterPool<Backend> pool(thread_count);
+        pool.count(deadline, core_counts);
+        timer.record(deadline);
+        count = std::accumulate(std::begin(core_counts), std::end(core_counts), std::int64_t{});
+    }
+    else  // Otherwise run in the main thread to take advantage of the CPU core affinity.
+    {
+        static typename Backend::Probe probe;
+        probe.begin();
+        timer.spinUntil(deadline, [&count]() { count += probe(); });
+        core_counts.assign(1, count);
+    }
+
+    const double elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(side_channel::FastClock::now() - started_at).count();
+    return {
+        deadline,
+        count,
+        elapsed_ns
+    };
+}
+
+/// The stream of the PHY measurements of one link: either live from the sampler (see Sampler::Port), or from the
+/// sampler daemon of the host (see SharedSource), or replayed from a trace (see side_channel_trace.hpp).
+class PHYSource
+{
+public:
+    virtual ~PHYSource() = default;
+
+    /// Blocks until the next measurement is available.
+    virtual PHYMeasurement next() = 0;
+
+    /// Returns empty at once if no measurement is available yet. The sources that never wait for their
+    /// measurements, such as the replayed traces, need not override this.
+    virtual std::optional<PHYMeasurement> poll() { return next(); }
+
+    /// The number of measurements lost because the consumer did not keep up.
+    virtual std::uint64_t getOverrunCount() const = 0;
+
+    /// The decoder reports the estimated clock rate error of its link; see readPHY().
+    virtual void setRateCorrection(const double value) = 0;
+};
+
+/// A PHY sample of one link timestamped at the end of its sampling window.
+struct PHYSample
+{
+    side_channel::FastClock::time_point timestamp;
+    bool level = false;     ///< True if the PHY is driven high by the transmitter.
+    float soft = 0.0F;      ///< Normalized deviation from the baseline; positive means high, magnitude is confidence.
+};
+
+/// Turns the raw measurements of the sampler into the samples of one link at the sample rate of its profile.
+/// Each sample integrates as many consecutive measurements as there are base chip periods per chip of the profile.
+/// The front end is stateful and belongs to the link because each link may use a different profile.
+class PHYFrontEnd
+{
+public:
+    /// Returns a new sample once per `decimation` measurements.
+    std::optional<PHYSample> feed(const PHYMeasurement& measurement)
+    {
+        count_ += measurement.count;
+        elapsed_ns_ += measurement.elapsed_ns;
+        if (++measurement_count_ < decimation_)
+        {
+            return {};
+        }
+        measurement_count_ = 0;
+
+        // Estimate the tick rate.
+        const double rate = double(count_) / elapsed_ns_;
+        count_ = 0;
+        elapsed_ns_ = 0.0;
+        if (!rate_average_)
+        {
+            rate_average_ = rate;
+        }
+
+        // Apply high-pass filtering to eliminate DC component.
+        *rate_average_ += (rate - *rate_average_) / PHYAveragingFactor;
+
+        // The soft sample is the deviation from the baseline normalized by the running standard deviation.
+        const double deviation = *rate_average_ - rate;
+        rate_variance_ += (deviation * deviation - rate_variance_) / PHYVarianceAveragingFactor;
+        const double soft = (rate_variance_ > 0.0) ? (deviation / std::sqrt(rate_variance_)) : 0.0;
+
+        // A smaller counter value means that the CPU time is being consumed by the sender, meaning it's the high level.
+        return PHYSample{
+            measurement.timestamp,
+            rate < *rate_average_,
+            std::clamp(static_cast<float>(soft), -SoftSampleLimit, SoftSampleLimit)
+        };
+    }
+
+    /// The tick rate baseline does not depend on the sampling window, so it is retained when the decimation
+    /// is changed; the variance of the measurement noise is inversely proportional to the window and is rescaled.
+    void setDecimation(const std::uint32_t decimation)
+    {
+        rate_variance_ *= double(decimation_) / double(decimation);
+        decimation_ = decimation;
+        measurement_count_ = 0;
+        count_ = 0;
+        elapsed_ns_ = 0.0;
+    }
+
+private:
+    std::uint32_t decimation_ = 1;
+    std::uint32_t measurement_count_ = 0;
+    std::int64_t  count_ = 0;
+    double        elapsed_ns_ = 0.0;
+
+    std::optional<double> rate_average_;
+    double rate_variance_ = 0.0;
+};
+
+/// A lock-free single-producer single-consumer ring buffer. The consumer may either block waiting for new items
+/// or poll them.
+template <typename T, std::uint32_t Capacity>
+class SPSCRing
+{
+    static_assert((Capacity > 0) && ((Capacity & (Capacity - 1U)) == 0), "Capacity shall be a power of two");
+
+public:
+    /// Producer side. Returns false if the ring is full, in which case the item is not stored.
+    bool push(const T& item)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if ((head - tail_.load(std::memory_order_acquire)) >= Capacity)
+        {
+            return false;
+        }
+        storage_[head % Capacity] = item;
+        head_.store(head + 1U, std::memory_order_release);
+        side_channel::futexWakeAll(head_);
+        return true;
+    }
+
+    /// Consumer side. Blocks until an item is available.
+    T pop()
+    {
+        for (;;)
+        {
+            if (auto out = tryPop())
+            {
+                return *out;
+            }
+            side_channel::futexWait(head_, tail_.load(std::memory_order_relaxed));
+        }
+    }
+
+    /// Consumer side. Returns empty at once if the ring is empty.
+    std::optional<T> tryPop()
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+        {
+            return {};
+        }
+        const T out = storage_[tail % Capacity];
+        tail_.store(tail + 1U, std::memory_order_release);
+        return out;
+    }
+
+private:
+    alignas(64) std::atomic<std::uint32_t> head_{0};   ///< Written by the producer only.
+    alignas(64) std::atomic<std::uint32_t> tail_{0};   ///< Written by the consumer only.
+    alignas(64) std::array<T, Capacity> storage_{};
+};
+
+/// Runs the PHY sampling loop in a dedicated thread that does nothing but measure and timestamp the samples.
+/// This way, the time spent on decoding is not stolen from the sampling windows, because readPHY() advances its
+/// deadline regardless. The sample stream is delivered to every consumer (e.g., one per CDMA link) through
+/// its own lock-free SPSC ring; if a consumer falls behind so much that its ring is full, the new samples are dropped
+/// for that consumer and counted as overruns. Each port measures its own set of cores, which allows the parallel
+/// lanes to be received separately from the same sampling windows (see side_channel_lanes.hpp).
+/// The sampler is specialized on the backend of the PHY; see side_channel_backend.hpp.
+template <typename Backend = side_channel::backend::Default>
+class BasicSampler
+{
+public:
+    /// The consumer side of the sample stream. Each port shall be used by one thread only.
+    class Port : public PHYSource
+    {
+    public:
+        PHYMeasurement next() override { return ring_.pop(); }
+
+        std::optional<PHYMeasurement> poll() override { return ring_.tryPop(); }
+
+        std::uint64_t getOverrunCount() const override { return overrun_count_.load(std::memory_order_relaxed); }
+
+        /// Only the first port disciplines the sampling clock because the links are not synchronized with each other;
+        /// the other links rely on their own delay-locked loops to follow the residual drift.
+        void setRateCorrection(const double value) override
+        {
+            rate_correction_.store(value, std::memory_order_relaxed);
+        }
+
+    private:
+        friend class BasicSampler;
+        /// About 20 seconds worth of measurements at the base sample rate.
+        static constexpr std::uint32_t RingCapacity = 65536;
+
+        explicit Port(std::vector<unsigned> cores) : cores_(std::move(cores)) { }
+
+        /// The sum over all cores is used as-is if the port measures all of them.
+        PHYMeasurement filter(const PHYMeasurement& all, const std::vector<std::int64_t>& core_counts) const
+        {
+            if (cores_.size() >= core_counts.size())
+            {
+                return all;
+            }
+            PHYMeasurement out = all;
+            out.count = 0;
+            for (auto core : cores_)
+            {
+                out.count += (core < core_counts.size()) ? core_counts[core] : 0;
+            }
+            return out;
+        }
+
+        const std::vector<unsigned> cores_;
+        SPSCRing<PHYMeasurement, RingCapacity> ring_;
+        std::atomic<std::uint64_t> overrun_count_{0};
+        std::atomic<double> rate_correction_{0.0};
+    };
+
+    /// One port per element; each element is the set of cores measured by the port.
+    /// If the trace writer is provided, every measurement is recorded into it before it is delivered.
+    /// If the timer metrics are provided, the timing of the sampling windows is accounted in them; see readPHY().
+    /// If the shared ring is provided, every measurement of all cores is published into it for the other processes;
+    /// the sampler of the daemon has no ports of its own (see sampler.cpp).
+    explicit BasicSampler(const std::vector<std::vector<unsigned>>& port_cores,
+                          trace::Writer* const                      trace  = nullptr,
+                          telemetry::TimerMetrics* const            timing = nullptr,
+                          shm::Writer* const                        shared = nullptr) :
+        trace_(trace),
+        shared_(shared)
+    {
+        timer_.setTelemetry(timing);
+        if (port_cores.empty() && (shared == nullptr))
+        {
+            throw std::invalid_argument("Sampler requires at least one port");
+        }
+        for (const auto& cores : port_cores)
+        {
+            ports_.push_back(std::unique_ptr<Port>(new Port(cores)));   // The constructor is private.
+        }
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~BasicSampler()
+    {
+        stop_ = true;
+        thread_.join();
+    }
+
+    BasicSampler(const BasicSampler&) = delete;
+    BasicSampler& operator=(const BasicSampler&) = delete;
+
+    Port& getPort(const std::size_t index) { return *ports_.at(index); }
+
+private:
+    void run()
+    {
+        side_channel::initThread();
+        std::vector<std::int64_t> core_counts;
+        while (!stop_)
+        {
+            // The sampling clock of the daemon is not disciplined because its measurements are shared by many links.
+            const double rate_correction =
+                ports_.empty() ? 0.0 : ports_.front()->rate_correction_.load(std::memory_order_relaxed);
+            const auto sample = readPHY<Backend>(rate_correction, core_counts, timer_);
+            if (trace_ != nullptr)
+            {
+                trace_->write(sample.timestamp.time_since_epoch().count(),
+                              static_cast<float>(sample.elapsed_ns),
+                              core_counts);
+            }
+            if (shared_ != nullptr)
+            {
+                shared_->write(sample.timestamp.time_since_epoch().count(), sample.elapsed_ns, core_counts);
+            }
+            for (auto& p : ports_)
+            {
+                if (!p->ring_.push(p->filter(sample, core_counts)))
+                {
+                    p->overrun_count_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Port>> ports_;
+    trace::Writer* const trace_;
+    shm::Writer* const shared_;
+    side_channel::timer::PrecisionTimer timer_;     ///< Used by the sampler thread only.
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+/// The sampler of the backend selected at build time.
+using Sampler = BasicSampler<>;
+
+/// The measurements of the sampler daemon of the host (see side_channel_shm.hpp) for one link. The cores are
+/// the PHY cores of the daemon, so that the lanes are defined by its core count rather than by that of the receiver.
+/// The sampling clock cannot be disciplined by the decoder because the ring is read-only and shared by all links;
+/// the delay-locked loop of the correlator follows the drift, like it does for the secondary links of the local
+/// sampler (see Sampler::Port::setRateCorrection()).
+class SharedSource : public PHYSource
+{
+public:
+    /// Throws std::runtime_error if the daemon is not running; see shm::Reader.
+    SharedSource(const std::string& name, std::vector<unsigned> cores) :
+        reader_(name),
+        cores_(std::move(cores))
+    { }
+
+    /// Throws std::runtime_error if the daemon stops.
+    PHYMeasurement next() override
+    {
+        (void)reader_.read(true);
+        return get();
+    }
+
+    std::optional<PHYMeasurement> poll() override
+    {
+        if (reader_.read(false))
+        {
+            return get();
+        }
+        return {};
+    }
+
+    std::uint64_t getOverrunCount() const override { return reader_.getOverrunCount(); }
+
+    void setRateCorrection(const double) override { }
+
+private:
+    PHYMeasurement get() const
+    {
+        PHYMeasurement out;
+        out.timestamp = side_channel::FastClock::time_point(std::chrono::nanoseconds(reader_.getTimestamp()));
+        out.elapsed_ns = reader_.getElapsed();
+        for (auto core : cores_)
+        {
+            out.count += reader_.getCount(core);
+        }
+        return out;
+    }
+
+    shm::Reader reader_;
+    const std::vector<unsigned> cores_;
+};
+
+}
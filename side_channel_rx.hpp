@@ -0,0 +1,733 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The receiving side of the link: the readers of the bits, frames, and packets built on top of the PHY
+/// (side_channel_phy.hpp) and the correlator (side_channel_correlator.hpp). It is used by the receiver, and also by
+/// the transmitter to receive the acknowledgements over the reverse channel (see side_channel_arq.hpp).
+/// Every reader can be either blocking (next()) or polled (poll()); the latter never blocks, so the whole stack
+/// can be stepped from a foreign event loop, and the packets are delivered as views of pooled buffers.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_crc.hpp"
+#include "side_channel_fec.hpp"
+#include "side_channel_telemetry.hpp"
+#include "side_channel_buffer.hpp"
+#include "side_channel_phy.hpp"
+#include "side_channel_correlator.hpp"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <type_traits>
+#include <algorithm>
+#include <optional>
+#include <variant>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace side_channel::rx
+{
+
+/// Reads data from the channel bit-by-bit. May read garbage if there is no carrier.
+/// The link profile can be changed at runtime; the correlator is replaced with one specialized for the new profile.
+class BitReader
+{
+    using Profile = side_channel::params::Profile;
+    using Sample = std::conditional_t<SoftDecision, float, bool>;
+
+    /// One correlator type per profile, in the same order as the profiles.
+    template <typename>
+    struct CorrelatorVariantOf;
+    template <typename... Ps>
+    struct CorrelatorVariantOf<std::variant<Ps...>>
+    {
+        using Type = std::variant<Correlator<typename Ps::Code, Sample, Ps::ShiftBits>...>;
+    };
+    using CorrelatorVariant = CorrelatorVariantOf<Profile>::Type;
+
+public:
+    /// The name identifies the link in the diagnostic output.
+    BitReader(PHYSource& port, const unsigned prn, std::string name) :
+        port_(port),
+        prn_(prn),
+        correlator_(std::in_place_index<0>, side_channel::params::RobustProfile::getCode(prn)),
+        name_(std::move(name))
+    {
+        front_end_.setDecimation(side_channel::params::RobustProfile::Decimation);
+    }
+
+    /// Blocks until the next bit is received. The result is the soft bit: positive if the bit is likely one, and
+    /// the magnitude is the confidence (the weighted vote of the correlation channels; see Correlator).
+    /// In the M-ary mode, each symbol yields several bits that are returned one by one; their magnitude is one
+    /// because the symbol detector makes a hard decision.
+    float next() { return *read(true); }
+
+    /// Same as next(), but returns empty at once if the PHY has no more samples available; the samples consumed
+    /// so far are retained, so the next call continues where this one stopped.
+    std::optional<float> poll() { return read(false); }
+
+    /// Switches the correlator to the specified profile. The code phase has to be acquired anew.
+    /// Throws std::invalid_argument if the PRN number of this link is not valid for the profile.
+    void setProfile(const Profile& profile)
+    {
+        if (profile.index() == profile_.index())
+        {
+            return;
+        }
+        const auto clock_error = std::visit([](const auto& c) { return c.getClockError(); }, correlator_);
+        std::visit([this](auto p)
+        {
+            using P = decltype(p);
+            correlator_.template emplace<side_channel::params::getProfileID<P>()>(P::getCode(prn_));
+            front_end_.setDecimation(P::Decimation);
+        }, profile);
+        std::visit([clock_error](auto& c) { c.setClockError(clock_error); }, correlator_);
+        profile_ = profile;
+        clock_latch_ = false;
+        pending_symbol_bits_ = 0;
+        block_.clear();
+        block_results_.clear();
+        block_result_index_ = 0;
+    }
+
+    const Profile& getProfile() const { return profile_; }
+
+    /// True if the correlator is locked onto the signal; the bits are not meaningful otherwise.
+    bool isTracking() const
+    {
+        return std::visit([](const auto& c) { return c.isTracking(); }, correlator_);
+    }
+
+    /// The timestamp of the last sample consumed by the correlator.
+    side_channel::FastClock::time_point getTime() const { return time_; }
+
+    /// The output is printed at once because multiple links may be printing concurrently.
+    void printDiagnostics(const bool bit)
+    {
+        std::visit([this, bit](const auto& c) { printDiagnostics(c, bit); }, correlator_);
+    }
+
+    /// Updates the metrics of the link; unlike printDiagnostics(), this is cheap enough to be done for every bit.
+    void publishTelemetry(side_channel::telemetry::LinkMetrics& metrics)
+    {
+        const bool tracking = isTracking();
+        if (tracking != published_tracking_)
+        {
+            (tracking ? metrics.lock_acquisitions : metrics.lock_losses).add();
+            published_tracking_ = tracking;
+        }
+        const auto [peak, floor] = std::visit([](const auto& c) { return c.getPeakAndFloor(); }, correlator_);
+        const double peak_to_mean = (floor > 0.0F) ? (double(peak) / double(floor)) : 0.0;
+        metrics.bits.add();
+        metrics.locked.set(tracking ? 1.0 : 0.0);
+        metrics.peak_correlation.set(peak);
+        metrics.peak_to_mean.set(peak_to_mean);
+        metrics.peak_correlation_histogram.add(peak);
+        metrics.peak_to_mean_histogram.add(peak_to_mean);
+        metrics.clock_error_ppm.set(std::visit([](const auto& c) { return c.getClockError(); }, correlator_) * 1e6);
+        metrics.overruns.set(double(port_.getOverrunCount()));
+    }
+
+private:
+    std::optional<float> read(const bool wait)
+    {
+        for (;;)
+        {
+            if (pending_symbol_bits_ > 0)
+            {
+                pending_symbol_bits_--;
+                return (((pending_symbol_ >> pending_symbol_bits_) & 1U) != 0U) ? 1.0F : -1.0F;
+            }
+
+            const auto maybe_result = nextCorrelatorResult(wait);
+            if (!maybe_result)
+            {
+                return {};
+            }
+            const auto& result = *maybe_result;
+
+            if (result.symbol_bits > 0)
+            {
+                std::visit([this](const auto& c) { port_.setRateCorrection(c.getRateCorrection()); }, correlator_);
+                pending_symbol_ = result.symbol;
+                pending_symbol_bits_ = result.symbol_bits;
+                continue;
+            }
+
+            if (!clock_latch_ && result.clock > 0.0F)
+            {
+                clock_latch_ = true;
+                std::visit([this](const auto& c) { port_.setRateCorrection(c.getRateCorrection()); }, correlator_);
+                return result.data;
+            }
+
+            if (clock_latch_ && result.clock < 0.0F)
+            {
+                clock_latch_ = false;
+            }
+        }
+    }
+
+    template <typename C>
+    void printDiagnostics(const C& correlator, const bool bit) const
+    {
+        const auto cvec = correlator.getCorrelationVector();
+        const auto [mean, stdev] = computeMeanStdev(cvec);
+        std::string line;
+        line.reserve(cvec.size() + 128U);
+        for (auto c : cvec)
+        {
+            if (c > 0.2F)  // Do not print the status of poorly correlated channels to reduce visual noise.
+            {
+                line.push_back("0123456789ABCDEF"[std::min(15, int(c * 16.0F))]);
+            }
+            else
+            {
+                line.push_back('.');
+            }
+        }
+        std::printf("%s: bit %d\n"
+                    "%s: %s mean=%.2f max=%.2f stdev=%.2f lock=%d prompt=%d phase=%+.2f clock=%+.1fppm "
+                    "overruns=%llu | %s\n",
+                    name_.c_str(),
+                    bit,
+                    name_.c_str(),
+                    std::visit([](auto p) { return decltype(p)::Name; }, profile_),
+                    mean,
+                    *std::max_element(std::begin(cvec), std::end(cvec)),
+                    stdev,
+                    correlator.isTracking(),
+                    correlator.isTracking() ? int(correlator.getPromptIndex()) : -1,
+                    correlator.getCodePhaseError(),
+                    correlator.getClockError() * 1e6,
+                    static_cast<unsigned long long>(port_.getOverrunCount()),
+                    line.c_str());
+        fflush(stdout);
+    }
+
+    /// Returns empty if the PHY has no measurement available and the caller does not wait.
+    std::optional<Sample> nextSample(const bool wait)
+    {
+        for (;;)
+        {
+            const auto measurement = wait ? std::optional<PHYMeasurement>(port_.next()) : port_.poll();
+            if (!measurement)
+            {
+                return {};
+            }
+            if (const auto s = front_end_.feed(*measurement))
+            {
+                time_ = s->timestamp;
+                if constexpr (SoftDecision)
+                {
+                    return s->soft;
+                }
+                else
+                {
+                    return s->level;
+                }
+            }
+        }
+    }
+
+    /// The block is accumulated across the calls if the samples run out in the middle of it.
+    std::optional<CorrelatorResult> nextCorrelatorResult(const bool wait)
+    {
+        if constexpr (BlockCorrelation)
+        {
+            if (block_result_index_ >= block_results_.size())
+            {
+                const bool complete = std::visit([this, wait](auto& c)
+                {
+                    while (block_.size() < std::decay_t<decltype(c)>::SequenceLength)
+                    {
+                        const auto sample = nextSample(wait);
+                        if (!sample)
+                        {
+                            return false;
+                        }
+                        block_.push_back(*sample);
+                    }
+                    block_results_ = c.feedBlock(block_);
+                    block_.clear();
+                    return true;
+                }, correlator_);
+                if (!complete)
+                {
+                    return {};
+                }
+                block_result_index_ = 0;
+            }
+            return block_results_.at(block_result_index_++);
+        }
+        else
+        {
+            const auto sample = nextSample(wait);
+            if (!sample)
+            {
+                return {};
+            }
+            return std::visit([&sample](auto& c) { return c.feed(*sample); }, correlator_);
+        }
+    }
+
+    PHYSource& port_;
+    const unsigned prn_;
+    PHYFrontEnd front_end_;
+    Profile profile_;
+    CorrelatorVariant correlator_;
+    const std::string name_;
+    bool clock_latch_ = false;
+    std::uint32_t pending_symbol_ = 0;
+    std::uint8_t  pending_symbol_bits_ = 0;
+    side_channel::FastClock::time_point time_{};
+    bool published_tracking_ = false;   ///< The lock state at the last publishTelemetry().
+
+    std::vector<Sample> block_;
+    std::vector<CorrelatorResult> block_results_;
+    std::size_t block_result_index_ = 0;
+};
+
+/// Finds the frames in the bit stream. The frame begins with the sync word followed by the frame header and the body
+/// (see side_channel::params::SyncWord). The sync word and the header are matched together in a sliding window at
+/// every bit, so a false match of the sync word in the noise cannot cause the real one that follows to be missed.
+/// The frames are searched for only while the correlator is tracking. A frame is received to the end even if the lock
+/// is lost in the middle of it, because a short fade is often corrected by the FEC; the CRC check decides.
+class FrameReader
+{
+public:
+    /// The body is returned as received, along with its soft bits (see BitReader::next()), MSB first.
+    struct RawFrame
+    {
+        std::uint8_t header = 0;
+        std::vector<std::uint8_t> body;
+        std::vector<float> soft;
+    };
+
+    FrameReader(PHYSource& port, const unsigned prn, std::string name) :
+        bit_reader_(port, prn, name),
+        name_(std::move(name))
+    { }
+
+    /// Consumes one bit. Returns the frame if it is completed by this bit; otherwise, returns null, which allows the
+    /// caller to check its timeouts between the frames. The buffers of the frame are reused for the next one, so the
+    /// frame is valid only until the next call.
+    const RawFrame* next() { return feed(bit_reader_.next()); }
+
+    /// Same as next(), but returns empty at once if the next bit is not yet available; see BitReader::poll().
+    std::optional<const RawFrame*> poll()
+    {
+        if (const auto soft = bit_reader_.poll())
+        {
+            return feed(*soft);
+        }
+        return {};
+    }
+
+    /// The partially received frame is discarded.
+    void setProfile(const side_channel::params::Profile& profile)
+    {
+        bit_reader_.setProfile(profile);
+        restart();
+    }
+
+    const BitReader& getBitReader() const { return bit_reader_; }
+
+    /// The diagnostics of every bit and the header errors are printed only if enabled because printing them takes
+    /// long enough to delay the decoding; see BitReader::printDiagnostics(). Use the telemetry for the monitoring.
+    void setDiagnosticsEnabled(const bool value) { diagnostics_enabled_ = value; }
+
+    /// The metrics are updated for every bit if set; see BitReader::publishTelemetry(). The metrics shall outlive
+    /// the reader.
+    void setTelemetry(side_channel::telemetry::LinkMetrics* const metrics) { telemetry_ = metrics; }
+
+private:
+    static constexpr std::uint32_t HeaderBits = side_channel::params::FrameHeaderSize * 8U;
+    static constexpr std::uint32_t WindowBits = side_channel::params::SyncWordLength + HeaderBits;
+    static_assert(WindowBits <= 64U);
+
+    const RawFrame* feed(const float soft)
+    {
+        const bool bit = soft > 0.0F;
+        if (diagnostics_enabled_)
+        {
+            bit_reader_.printDiagnostics(bit);
+        }
+        if (telemetry_ != nullptr)
+        {
+            bit_reader_.publishTelemetry(*telemetry_);
+        }
+        if (!remaining_bits_)
+        {
+            window_ = (window_ << 1U) | (bit ? 1U : 0U);
+            window_bits_ = std::min(window_bits_ + 1U, WindowBits);
+            if ((window_bits_ >= WindowBits) && bit_reader_.isTracking())
+            {
+                return detect();
+            }
+            return nullptr;
+        }
+        const auto index = frame_.soft.size();
+        frame_.body[index / 8U] |= static_cast<std::uint8_t>(bit ? (0x80U >> (index % 8U)) : 0U);
+        frame_.soft.push_back(soft);
+        if (--*remaining_bits_ == 0U)
+        {
+            restart();
+            return &frame_;
+        }
+        return nullptr;
+    }
+
+    const RawFrame* detect()
+    {
+        using side_channel::params::SyncWord;
+        using side_channel::params::SyncWordLength;
+        const auto sync = static_cast<std::uint32_t>(window_ >> HeaderBits) & ((1U << SyncWordLength) - 1U);
+        const auto sync_errors = static_cast<std::uint32_t>(__builtin_popcount(sync ^ SyncWord));
+        if (sync_errors > side_channel::params::SyncWordMaxBitErrors)
+        {
+            return nullptr;
+        }
+        std::array<std::uint8_t, side_channel::params::FrameHeaderSize> header{};
+        for (auto i = 0U; i < header.size(); i++)
+        {
+            header[i] = static_cast<std::uint8_t>(window_ >> (HeaderBits - (8U * (i + 1U))));
+        }
+        side_channel::crc::CRC16CCITT crc;
+        crc.add(header.data(), 3U);
+        if (crc.get() != ((std::uint16_t(header[3]) << 8U) | header[4]))
+        {
+            if (diagnostics_enabled_)
+            {
+                std::printf("%s: header crc error\n", name_.c_str());
+            }
+            if (telemetry_ != nullptr)
+            {
+                telemetry_->header_crc_errors.add();
+            }
+            return nullptr;
+        }
+        // The buffers retain their capacity, so nothing is allocated once the largest frame has been received.
+        frame_.header = header[0];
+        frame_.body.assign((std::size_t(header[1]) << 8U) | header[2], 0);
+        frame_.soft.clear();
+        frame_.soft.reserve(frame_.body.size() * 8U);
+        if (frame_.body.empty())
+        {
+            restart();
+            return &frame_;
+        }
+        remaining_bits_ = static_cast<std::uint32_t>(frame_.body.size() * 8U);
+        return nullptr;
+    }
+
+    void restart()
+    {
+        remaining_bits_.reset();
+        window_ = 0;
+        window_bits_ = 0;
+    }
+
+    BitReader bit_reader_;
+    const std::string name_;
+    bool diagnostics_enabled_ = false;
+    side_channel::telemetry::LinkMetrics* telemetry_ = nullptr;
+
+    std::uint64_t window_ = 0;                      ///< The last bits, the newest one in the LSB.
+    std::uint32_t window_bits_ = 0;                 ///< The number of valid bits in the window.
+    std::optional<std::uint32_t> remaining_bits_;   ///< Empty while searching for the sync word.
+    RawFrame frame_;
+};
+
+/// A received packet of the specified type. The payload is a view of a buffer borrowed from the pool of the reader,
+/// which is returned when the packet is destroyed; the packet may be retained (moved) by the application for as long
+/// as needed. This is a plain pointer and size rather than std::span because the code base is C++17.
+class Packet
+{
+public:
+    Packet(const side_channel::params::FrameType type,
+           side_channel::buffer::Buffer      buffer,
+           const std::size_t                 offset,
+           const std::size_t                 size) :
+        type_(type),
+        buffer_(std::move(buffer)),
+        offset_(offset),
+        size_(size)
+    { }
+
+    side_channel::params::FrameType getType() const { return type_; }
+
+    const std::uint8_t* data() const { return buffer_.getBytes().data() + offset_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0U; }
+
+    const std::uint8_t* begin() const { return data(); }
+    const std::uint8_t* end() const { return data() + size_; }
+
+    std::uint8_t operator[](const std::size_t index) const { return data()[index]; }
+
+private:
+    side_channel::params::FrameType type_;
+    side_channel::buffer::Buffer buffer_;
+    std::size_t offset_;
+    std::size_t size_;
+};
+
+/// Reads full data packets from the channel.
+/// Packets are found by the frame reader. The header byte of the packet specifies the CRC kind
+/// (see side_channel::crc::Kind), the FEC kind (see side_channel::fec::Kind), and the frame type
+/// (see side_channel::params::FrameType), and the packet ends with the CRC of all preceding bytes (big endian).
+/// If the packet is FEC-encoded, the FEC is decoded from the soft bits before the CRC is checked.
+/// The link is received using the robust profile until a profile announcement is received, after which the frames
+/// of the announced burst are received using the announced profile, and then the reader returns to the robust profile.
+/// The reader is either blocking (next()) or polled (poll()); the same reader may be used both ways.
+class PacketReader
+{
+    template <class Visitor, class... Variants>
+    friend constexpr auto visit( Visitor&& vis, Variants&&... vars );
+
+public:
+    struct Frame
+    {
+        side_channel::params::FrameType type;
+        std::vector<std::uint8_t> payload;
+    };
+
+    PacketReader(PHYSource& port, const unsigned prn, const std::string& name) :
+        frame_reader_(port, prn, name),
+        decoder_(name),
+        name_(name)
+    { }
+
+    /// The profile announcements are handled internally; the other frames are returned.
+    Frame next() { return *next(side_channel::FastClock::time_point::max()); }
+
+    /// Same as above, but gives up and returns empty once the received signal reaches the deadline.
+    /// This is used to wait for a response over a half-duplex link.
+    std::optional<Frame> next(const side_channel::FastClock::time_point deadline)
+    {
+        std::optional<Frame> out;
+        const auto handler = [&out](Packet&& packet)
+        {
+            out = Frame{packet.getType(), {std::begin(packet), std::end(packet)}};
+        };
+        while (!out && (frame_reader_.getBitReader().getTime() < deadline))
+        {
+            (void)step(true, handler);
+        }
+        return out;
+    }
+
+    /// Never blocks: consumes all samples that the PHY has available and invokes the handler with every packet
+    /// received from them, in the calling thread. The handler takes the Packet by rvalue reference and may move it
+    /// to retain its buffer. Returns the number of the packets delivered. This is meant to be called from
+    /// the event loop of the application often enough to keep up with the sample rate; see PHYSource::poll().
+    template <typename F>
+    std::size_t poll(F&& handler)
+    {
+        std::size_t count = 0;
+        const auto counting = [&count, &handler](Packet&& packet)
+        {
+            count++;
+            handler(std::move(packet));
+        };
+        while (step(false, counting))
+        {
+        }
+        return count;
+    }
+
+    void setDiagnosticsEnabled(const bool value) { frame_reader_.setDiagnosticsEnabled(value); }
+
+    /// See FrameReader::setTelemetry(). The frames and the frame errors are counted in addition.
+    void setTelemetry(side_channel::telemetry::LinkMetrics* const metrics)
+    {
+        frame_reader_.setTelemetry(metrics);
+        decoder_.setTelemetry(metrics);
+    }
+
+    /// The time of the last received sample; see BitReader::getTime().
+    side_channel::FastClock::time_point getTime() const { return frame_reader_.getBitReader().getTime(); }
+
+private:
+    /// The receiver waits for the announced frame this many times longer than it takes to transmit.
+    static constexpr auto AnnouncedFrameTimeoutMargin = 2;
+
+    /// Consumes one bit. Returns false if the bit is not available and the caller does not wait.
+    template <typename F>
+    bool step(const bool wait, const F& handler)
+    {
+        using RawFrame = FrameReader::RawFrame;
+        const auto raw = wait ? std::optional<const RawFrame*>(frame_reader_.next()) : frame_reader_.poll();
+        if (!raw)
+        {
+            return false;
+        }
+        if (auto packet = (*raw != nullptr) ? decoder_(**raw, pool_) : std::nullopt)
+        {
+            if (packet->getType() == side_channel::params::FrameType::ProfileAnnouncement)
+            {
+                onProfileAnnouncement(*packet);
+                return true;
+            }
+            if (deadline_ && (--remaining_frames_ == 0U))
+            {
+                revertProfile();
+            }
+            handler(std::move(*packet));
+            return true;
+        }
+        if (deadline_ && (frame_reader_.getBitReader().getTime() > *deadline_))
+        {
+            std::printf("%s: announced frame not received\n", name_.c_str());
+            revertProfile();
+        }
+        return true;
+    }
+
+    /// Decodes the FEC and checks the CRC of the received frame. The frame is decoded into a buffer from the pool,
+    /// and the payload of the packet is a view of it.
+    class FrameDecoder
+    {
+    public:
+        explicit FrameDecoder(std::string name) : name_(std::move(name)) { }
+
+        void setTelemetry(side_channel::telemetry::LinkMetrics* const metrics) { telemetry_ = metrics; }
+
+        /// The header byte is not encoded by the FEC, so it is used as-is to tell how to decode the body.
+        std::optional<Packet> operator()(const FrameReader::RawFrame& raw, side_channel::buffer::Pool& pool) const
+        {
+            const auto crc_kind = static_cast<side_channel::crc::Kind>(raw.header & 0x03U);
+            const auto fec_kind = static_cast<side_channel::fec::Kind>((raw.header >> 2U) & 0x03U);
+            const auto type = static_cast<side_channel::params::FrameType>(raw.header >> 4U);
+            const auto crc_size = side_channel::crc::getSize(crc_kind);
+            if (!crc_size)
+            {
+                std::printf("%s: unknown crc kind\n", name_.c_str());
+                return {};
+            }
+            auto buffer = pool.acquire();
+            auto& frame = buffer.getBytes();
+            frame.push_back(raw.header);
+            if (fec_kind == side_channel::fec::Kind::None)
+            {
+                frame.insert(std::end(frame), std::begin(raw.body), std::end(raw.body));
+            }
+            else if (const auto decoded = side_channel::fec::decode(fec_kind, raw.soft.data(), raw.soft.size()))
+            {
+                frame.insert(std::end(frame), std::begin(*decoded), std::end(*decoded));
+                printCorrections(fec_kind, *decoded, raw.body);
+            }
+            else
+            {
+                std::printf("%s: fec error\n", name_.c_str());
+                count(&side_channel::telemetry::LinkMetrics::fec_errors);
+                return {};
+            }
+            if ((frame.size() <= *crc_size) || !side_channel::crc::check(crc_kind, frame.data(), frame.size()))
+            {
+                std::printf("%s: crc error\n", name_.c_str());
+                count(&side_channel::telemetry::LinkMetrics::crc_errors);
+                return {};
+            }
+            if (static_cast<std::uint8_t>(type) > static_cast<std::uint8_t>(side_channel::params::FrameType::Ack))
+            {
+                std::printf("%s: unknown frame type\n", name_.c_str());
+                return {};
+            }
+            count(&side_channel::telemetry::LinkMetrics::frames);
+            // Drop the header from the beginning and the CRC from the end.
+            const auto size = frame.size() - 1U - *crc_size;
+            return Packet(type, std::move(buffer), 1U, size);
+        }
+
+    private:
+        /// The number of corrected bits is found by encoding the decoded data again and comparing it with the
+        /// received bits, which is a useful measure of the link quality.
+        void printCorrections(const side_channel::fec::Kind     kind,
+                              const std::vector<std::uint8_t>& decoded,
+                              const std::vector<std::uint8_t>& received) const
+        {
+            const auto reference = side_channel::fec::encode(kind, decoded.data(), decoded.size());
+            unsigned count = 0;
+            for (std::size_t i = 0; (i < reference.size()) && (i < received.size()); i++)
+            {
+                count += static_cast<unsigned>(__builtin_popcount(reference[i] ^ received[i]));
+            }
+            if (count > 0)
+            {
+                std::printf("%s: fec corrected %u bits\n", name_.c_str(), count);
+            }
+        }
+
+        void count(side_channel::telemetry::Counter side_channel::telemetry::LinkMetrics::* const counter) const
+        {
+            if (telemetry_ != nullptr)
+            {
+                (telemetry_->*counter).add();
+            }
+        }
+
+        const std::string name_;
+        side_channel::telemetry::LinkMetrics* telemetry_ = nullptr;
+    };
+
+    /// The announcement contains the profile ID, the total body size, the preamble length, and the number of the frames
+    /// of the burst that follows. The deadline covers the robust postamble and the burst in the announced profile.
+    void onProfileAnnouncement(const Packet& payload)
+    {
+        using side_channel::params::RobustProfile;
+        const auto profile = (payload.size() == 8U) ? side_channel::params::findProfile(payload[0]) : std::nullopt;
+        if (!profile)
+        {
+            std::printf("%s: unknown profile announced\n", name_.c_str());
+            return;
+        }
+        const std::uint32_t body_size = (std::uint32_t(payload[1]) << 24U) | (std::uint32_t(payload[2]) << 16U) |
+                                        (std::uint32_t(payload[3]) << 8U)  | std::uint32_t(payload[4]);
+        const std::uint32_t preamble_length = payload[5];
+        const std::uint32_t frame_count = std::max<std::uint32_t>(1U, (std::uint32_t(payload[6]) << 8U) | payload[7]);
+        const auto frame_duration = std::visit([body_size, preamble_length, frame_count](auto p)
+        {
+            return decltype(p)::getFrameDuration(body_size, preamble_length, frame_count);
+        }, *profile);
+        const auto postamble_duration = RobustProfile::SymbolPeriod * side_channel::params::PostambleLength;
+        try
+        {
+            frame_reader_.setProfile(*profile);
+        }
+        catch (const std::invalid_argument& ex)
+        {
+            std::printf("%s: cannot switch profile: %s\n", name_.c_str(), ex.what());
+            return;
+        }
+        deadline_ = frame_reader_.getBitReader().getTime() +
+                    (postamble_duration + frame_duration) * AnnouncedFrameTimeoutMargin;
+        remaining_frames_ = frame_count;
+        std::printf("%s: switched to profile %s for %u frames of %u bytes\n",
+                    name_.c_str(),
+                    std::visit([](auto p) { return decltype(p)::Name; }, *profile),
+                    static_cast<unsigned>(frame_count),
+                    static_cast<unsigned>(body_size));
+    }
+
+    void revertProfile()
+    {
+        frame_reader_.setProfile(side_channel::params::RobustProfile{});
+        deadline_.reset();
+    }
+
+    FrameReader frame_reader_;
+    FrameDecoder decoder_;
+    side_channel::buffer::Pool pool_;
+    const std::string name_;
+    std::optional<side_channel::FastClock::time_point> deadline_;
+    std::uint32_t remaining_frames_ = 0;    ///< The frames of the announced burst not yet received.
+};
+
+}
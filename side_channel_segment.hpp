@@ -0,0 +1,97 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Segmented file transfer: the file is split into segments of a fixed size (except the last one, which may be
+/// shorter), and each segment is sent in its own frame of type params::FrameType::Segment. The segment header
+/// identifies the file and the position of the segment in it, so the receiver can write every segment into
+/// the output file at its offset as soon as it arrives, in any order, and a corrupt segment only costs itself.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace side_channel::segment
+{
+
+/// The segment size is limited such that the frame fits into params::MaxFrameBodySize even with the FEC.
+static constexpr std::size_t MaxSegmentSize     = 16384;
+static constexpr std::size_t DefaultSegmentSize = 128;
+
+/// All fields are big endian. The file ID is chosen randomly by the transmitter for each transfer.
+struct Header
+{
+    static constexpr std::size_t Size = 14;
+
+    std::uint32_t file_id = 0;
+    std::uint32_t index = 0;            ///< The sequence number of the segment in [0, count).
+    std::uint32_t count = 0;            ///< The total number of segments in the file; at least one.
+    std::uint16_t segment_size = 0;     ///< The size of every segment except the last one.
+
+    /// The offset of the segment in the file.
+    std::uint64_t getOffset() const { return std::uint64_t(index) * segment_size; }
+};
+
+/// An empty file is sent as a single empty segment.
+inline std::uint32_t getSegmentCount(const std::uint64_t file_size, const std::size_t segment_size)
+{
+    return static_cast<std::uint32_t>(std::max<std::uint64_t>(1U, (file_size + segment_size - 1U) / segment_size));
+}
+
+/// Returns the header followed by the data.
+inline std::vector<std::uint8_t> makeSegment(const Header&             header,
+                                             const std::uint8_t* const data,
+                                             const std::size_t         size)
+{
+    std::vector<std::uint8_t> out;
+    out.reserve(Header::Size + size);
+    const auto put = [&out](const std::uint32_t value, const unsigned byte_count)
+    {
+        for (auto i = byte_count; i --> 0U;)
+        {
+            out.push_back(static_cast<std::uint8_t>(value >> (i * 8U)));
+        }
+    };
+    put(header.file_id, 4U);
+    put(header.index, 4U);
+    put(header.count, 4U);
+    put(header.segment_size, 2U);
+    out.insert(std::end(out), data, data + size);
+    return out;
+}
+
+/// Empty if the segment is too short, or the header is inconsistent with the size of the segment data.
+inline std::optional<Header> parseSegmentHeader(const std::vector<std::uint8_t>& segment)
+{
+    if (segment.size() < Header::Size)
+    {
+        return {};
+    }
+    const auto get = [&segment](const std::size_t offset, const unsigned byte_count)
+    {
+        std::uint32_t out = 0;
+        for (auto i = 0U; i < byte_count; i++)
+        {
+            out = (out << 8U) | segment[offset + i];
+        }
+        return out;
+    };
+    Header out;
+    out.file_id = get(0, 4U);
+    out.index = get(4, 4U);
+    out.count = get(8, 4U);
+    out.segment_size = static_cast<std::uint16_t>(get(12, 2U));
+    const auto data_size = segment.size() - Header::Size;
+    const bool is_last = (out.index + 1U) == out.count;
+    if ((out.index >= out.count) || (out.segment_size == 0U) || (out.segment_size > MaxSegmentSize) ||
+        (data_size > out.segment_size) || (!is_last && (data_size != out.segment_size)))
+    {
+        return {};
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,370 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The fan-out of the PHY measurements to the decoder processes through shared memory. The sampler daemon
+/// (see sampler.cpp) is the only process on the host that loads the cores with the counter threads; it publishes
+/// every measurement into a ring in a POSIX shared memory object, and any number of receivers attach to it read-only
+/// (rx --attach), each decoding its own links. Adding a link therefore costs the CPU time of its decoder only,
+/// and two receivers on the same host do not disturb the measurements of each other.
+///
+/// The ring is lock-free; the slots are protected by sequence counters (a seqlock per slot): the writer makes the
+/// sequence odd while the slot is being written, and the readers retry or skip the slot if its sequence has changed
+/// while it was being read. The writer never waits for the readers; a reader that falls behind by more than the
+/// capacity of the ring loses the oldest measurements, which are counted as overruns.
+/// The daemon holds an exclusive file lock on the shared memory object while it is running, which is how the readers
+/// tell a stopped daemon from a quiet one.
+///
+/// The timestamps are those of side_channel::FastClock of the daemon; the clock is calibrated against steady_clock,
+/// which is common to all processes of the host, so the timestamps agree with the local clock of the receivers.
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace side_channel::shm
+{
+
+/// The name of the shared memory object used by default by both the daemon and the receivers.
+static constexpr const char* DefaultName = "/side_channel";
+/// About 20 seconds worth of measurements at the base sample rate, like the ring of each local port.
+static constexpr std::uint32_t DefaultCapacity = 65536;
+/// A blocked reader checks whether the daemon is still running this often.
+static constexpr std::chrono::milliseconds LivenessCheckInterval{100};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::int64_t>::is_always_lock_free &&
+              std::atomic<double>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free,
+              "The atomics in shared memory shall be lock-free to be usable across processes");
+
+struct RingHeader
+{
+    static constexpr std::uint32_t Magic   = 0x4D534353U;   ///< "SCSM" in the little endian byte order.
+    static constexpr std::uint16_t Version = 1;
+
+    std::uint32_t magic = Magic;
+    std::uint16_t version = Version;
+    std::uint16_t core_count = 0;
+    std::uint32_t capacity = 0;             ///< The number of the slots; a power of two.
+    std::uint32_t slot_size = 0;            ///< In bytes, including the counts of all cores.
+    std::uint32_t sample_duration_ns = 0;   ///< The nominal duration of the sampling window of the daemon.
+
+    alignas(64) std::atomic<std::uint64_t> head{0};     ///< The number of the measurements published so far.
+    std::atomic<std::uint32_t> wake{0};                 ///< The futex word: the low 32 bits of the head.
+};
+
+/// The slot is followed by the tick count of each core (std::atomic<std::int64_t>[core_count]).
+struct Slot
+{
+    std::atomic<std::uint64_t> sequence{0};     ///< 2*N+1 while the Nth measurement is written, 2*N+2 once written.
+    std::atomic<std::int64_t> timestamp_ns{0};
+    std::atomic<double> elapsed_ns{0.0};
+};
+
+namespace detail
+{
+inline std::size_t getSlotSize(const std::size_t core_count)
+{
+    const auto size = sizeof(Slot) + (core_count * sizeof(std::atomic<std::int64_t>));
+    return (size + 63U) & ~std::size_t(63U);    // Avoid false sharing between the adjacent slots.
+}
+
+inline std::size_t getMappingSize(const std::size_t core_count, const std::size_t capacity)
+{
+    return sizeof(RingHeader) + (getSlotSize(core_count) * capacity);
+}
+
+inline std::atomic<std::int64_t>* getCounts(Slot* const slot)
+{
+    return reinterpret_cast<std::atomic<std::int64_t>*>(reinterpret_cast<std::uint8_t*>(slot) + sizeof(Slot));
+}
+
+/// The futex is shared between the processes, unlike the ones in side_channel_params.hpp.
+inline void futexWait(const std::atomic<std::uint32_t>& word,
+                      const std::uint32_t               expected,
+                      const std::chrono::nanoseconds    timeout)
+{
+    timespec ts{};
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1'000'000'000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1'000'000'000);
+    (void)syscall(SYS_futex, &word, FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline void futexWakeAll(std::atomic<std::uint32_t>& word)
+{
+    (void)syscall(SYS_futex, &word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+}
+
+/// The daemon side. Creates the shared memory object, replacing a stale one left by a daemon that has crashed;
+/// the object is removed at destruction. Only one thread shall write.
+class Writer
+{
+public:
+    /// Throws std::runtime_error if the object cannot be created or if another daemon is using the same name.
+    Writer(std::string                    name,
+           const unsigned                 core_count,
+           const std::chrono::nanoseconds sample_duration,
+           const std::uint32_t            capacity = DefaultCapacity) :
+        name_(std::move(name)),
+        capacity_(capacity),
+        slot_size_(detail::getSlotSize(core_count)),
+        size_(detail::getMappingSize(core_count, capacity))
+    {
+        if ((capacity == 0U) || ((capacity & (capacity - 1U)) != 0U) || (core_count == 0U) || (core_count > 0xFFFFU))
+        {
+            throw std::invalid_argument("Invalid shared ring configuration");
+        }
+        // The existing object is removed only if it is not locked by its daemon; the readers that still map it
+        // will find out that its daemon is gone.
+        if (const int stale = ::shm_open(name_.c_str(), O_RDONLY, 0); stale >= 0)
+        {
+            const bool running = ::flock(stale, LOCK_EX | LOCK_NB) != 0;
+            (void)::close(stale);
+            if (running)
+            {
+                throw std::runtime_error("Another sampler is publishing into " + name_);
+            }
+            (void)::shm_unlink(name_.c_str());
+        }
+        fd_ = ::shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if ((fd_ < 0) || (::flock(fd_, LOCK_EX | LOCK_NB) != 0) || (::ftruncate(fd_, off_t(size_)) != 0))
+        {
+            cleanup();
+            throw std::runtime_error("Cannot create shared memory object " + name_);
+        }
+        void* const data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED)
+        {
+            cleanup();
+            throw std::runtime_error("Cannot map shared memory object " + name_);
+        }
+        data_ = static_cast<std::uint8_t*>(data);
+        header_ = new (data_) RingHeader();
+        header_->core_count = static_cast<std::uint16_t>(core_count);
+        header_->capacity = capacity;
+        header_->slot_size = static_cast<std::uint32_t>(slot_size_);
+        header_->sample_duration_ns = static_cast<std::uint32_t>(sample_duration.count());
+        for (std::uint32_t i = 0; i < capacity; i++)
+        {
+            Slot* const slot = new (data_ + sizeof(RingHeader) + (i * slot_size_)) Slot();
+            for (auto c = 0U; c < core_count; c++)
+            {
+                (void) new (detail::getCounts(slot) + c) std::atomic<std::int64_t>(0);
+            }
+        }
+    }
+
+    ~Writer()
+    {
+        (void)::munmap(data_, size_);
+        cleanup();
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    /// The counts are indexed by core; the missing ones are published as zero. Never blocks.
+    void write(const std::int64_t timestamp_ns, const double elapsed_ns, const std::vector<std::int64_t>& counts)
+    {
+        const auto index = head_;
+        Slot* const slot = reinterpret_cast<Slot*>(data_ + sizeof(RingHeader) + ((index % capacity_) * slot_size_));
+        slot->sequence.store((2U * index) + 1U, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+        slot->elapsed_ns.store(elapsed_ns, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < header_->core_count; i++)
+        {
+            detail::getCounts(slot)[i].store((i < counts.size()) ? counts[i] : 0, std::memory_order_relaxed);
+        }
+        slot->sequence.store((2U * index) + 2U, std::memory_order_release);
+        head_ = index + 1U;
+        header_->head.store(head_, std::memory_order_release);
+        header_->wake.store(static_cast<std::uint32_t>(head_), std::memory_order_release);
+        detail::futexWakeAll(header_->wake);
+    }
+
+    const std::string& getName() const { return name_; }
+
+private:
+    void cleanup()
+    {
+        if (fd_ >= 0)
+        {
+            (void)::shm_unlink(name_.c_str());
+            (void)::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    const std::string name_;
+    const std::uint32_t capacity_;
+    const std::size_t slot_size_;
+    const std::size_t size_;
+    int fd_ = -1;
+    std::uint8_t* data_ = nullptr;
+    RingHeader* header_ = nullptr;
+    std::uint64_t head_ = 0;
+};
+
+/// The receiver side. Maps the object read-only; the reader starts at the newest measurement, so it sees only the
+/// measurements published after it has attached. Each reader has its own position, so every link shall use its own.
+/// Not thread-safe.
+class Reader
+{
+public:
+    /// Throws std::runtime_error if there is no running daemon publishing under the name.
+    explicit Reader(const std::string& name) : name_(name)
+    {
+        fd_ = ::shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat st{};
+        if ((fd_ < 0) || (::fstat(fd_, &st) != 0) || (static_cast<std::size_t>(st.st_size) < sizeof(RingHeader)))
+        {
+            close();
+            throw std::runtime_error("No sampler is publishing into " + name);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void* const data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED)
+        {
+            close();
+            throw std::runtime_error("Cannot map shared memory object " + name);
+        }
+        data_ = static_cast<const std::uint8_t*>(data);
+        header_ = reinterpret_cast<const RingHeader*>(data_);
+        if ((header_->magic != RingHeader::Magic) || (header_->version != RingHeader::Version) ||
+            (header_->core_count == 0U) || (header_->capacity == 0U) ||
+            (header_->slot_size != detail::getSlotSize(header_->core_count)) ||
+            (size_ < detail::getMappingSize(header_->core_count, header_->capacity)) || !isWriterAlive())
+        {
+            close();
+            throw std::runtime_error("No valid sampler ring in " + name);
+        }
+        counts_.resize(header_->core_count, 0);
+        next_ = header_->head.load(std::memory_order_acquire);
+    }
+
+    ~Reader() { close(); }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    unsigned getCoreCount() const { return header_->core_count; }
+    std::uint32_t getCapacity() const { return header_->capacity; }
+    std::chrono::nanoseconds getSampleDuration() const { return std::chrono::nanoseconds(header_->sample_duration_ns); }
+
+    /// Advances to the next measurement, which is then available through the getters. If there is none yet,
+    /// returns false at once unless waiting, in which case it blocks until there is one.
+    /// Throws std::runtime_error if the daemon has stopped while waiting.
+    bool read(const bool wait)
+    {
+        for (;;)
+        {
+            const auto head = header_->head.load(std::memory_order_acquire);
+            if (next_ >= head)
+            {
+                if (!wait)
+                {
+                    return false;
+                }
+                detail::futexWait(header_->wake, static_cast<std::uint32_t>(head), LivenessCheckInterval);
+                if ((header_->head.load(std::memory_order_acquire) == head) && !isWriterAlive())
+                {
+                    throw std::runtime_error("The sampler publishing into " + name_ + " has stopped");
+                }
+                continue;
+            }
+            if ((head - next_) > header_->capacity)
+            {
+                overrun_count_ += head - next_ - header_->capacity;
+                next_ = head - header_->capacity;
+            }
+            if (copy(next_++))
+            {
+                return true;
+            }
+            overrun_count_++;   // The slot has been overwritten by the writer while being read.
+        }
+    }
+
+    std::int64_t getTimestamp() const { return timestamp_ns_; }
+    double getElapsed() const { return elapsed_ns_; }
+    std::int64_t getCount(const unsigned core) const { return (core < counts_.size()) ? counts_[core] : 0; }
+
+    /// The number of measurements lost because this reader did not keep up.
+    std::uint64_t getOverrunCount() const { return overrun_count_; }
+
+    /// The daemon holds the exclusive lock while it is running.
+    bool isWriterAlive() const
+    {
+        if (::flock(fd_, LOCK_SH | LOCK_NB) == 0)
+        {
+            (void)::flock(fd_, LOCK_UN);
+            return false;
+        }
+        return errno == EWOULDBLOCK;
+    }
+
+private:
+    /// The seqlock read: the copy is valid only if the sequence is the expected one before and after it.
+    bool copy(const std::uint64_t index)
+    {
+        const std::size_t offset = sizeof(RingHeader) + ((index % header_->capacity) * header_->slot_size);
+        Slot* const slot = reinterpret_cast<Slot*>(const_cast<std::uint8_t*>(data_ + offset));
+        const auto expected = (2U * index) + 2U;
+        if (slot->sequence.load(std::memory_order_acquire) != expected)
+        {
+            return false;
+        }
+        timestamp_ns_ = slot->timestamp_ns.load(std::memory_order_relaxed);
+        elapsed_ns_ = slot->elapsed_ns.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < counts_.size(); i++)
+        {
+            counts_[i] = detail::getCounts(slot)[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot->sequence.load(std::memory_order_relaxed) == expected;
+    }
+
+    void close()
+    {
+        if (data_ != nullptr)
+        {
+            (void)::munmap(const_cast<std::uint8_t*>(data_), size_);
+            data_ = nullptr;
+        }
+        if (fd_ >= 0)
+        {
+            (void)::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    const std::string name_;
+    int fd_ = -1;
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    const RingHeader* header_ = nullptr;
+    std::uint64_t next_ = 0;
+    std::uint64_t overrun_count_ = 0;
+
+    std::int64_t timestamp_ns_ = 0;
+    double elapsed_ns_ = 0.0;
+    std::vector<std::int64_t> counts_;
+};
+
+}
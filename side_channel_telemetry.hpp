@@ -0,0 +1,315 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The metrics of the receiver. The decoder threads update them using relaxed atomic operations only, so that
+/// the monitoring does not delay the decoding, which would degrade the link. A background thread takes a snapshot
+/// of all metrics periodically and writes it into a file and/or prints it; the file is replaced atomically, so it can
+/// be read at any time. Place the file in /dev/shm to keep it in memory.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace side_channel::telemetry
+{
+
+class Counter
+{
+public:
+    void add(const std::uint64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+class Gauge
+{
+public:
+    void set(const double value) { value_.store(value, std::memory_order_relaxed); }
+    double get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value_{0.0};
+};
+
+/// The bins are of equal width over [min, max); the values outside of the range are counted in the outermost bins.
+template <std::size_t BinCount>
+class Histogram
+{
+public:
+    Histogram(const double min, const double max) : min_(min), max_(max) { }
+
+    void add(const double value)
+    {
+        if (std::isnan(value))
+        {
+            return;
+        }
+        const double position = std::clamp((value - min_) / (max_ - min_), 0.0, 1.0) * double(BinCount);
+        bins_[std::min(static_cast<std::size_t>(position), BinCount - 1U)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t get(const std::size_t index) const { return bins_.at(index).load(std::memory_order_relaxed); }
+
+    double getMin() const { return min_; }
+    double getMax() const { return max_; }
+
+    static constexpr std::size_t size() { return BinCount; }
+
+private:
+    const double min_;
+    const double max_;
+    std::array<std::atomic<std::uint64_t>, BinCount> bins_{};
+};
+
+/// The metrics of one lane of one link. The decoder updates the gauges and the histograms once per bit.
+struct LinkMetrics
+{
+    explicit LinkMetrics(std::string link_name) : name(std::move(link_name)) { }
+
+    const std::string name;
+
+    Counter bits;
+    Counter frames;                 ///< Passed the CRC check.
+    Counter header_crc_errors;
+    Counter fec_errors;
+    Counter crc_errors;
+    Counter lock_acquisitions;
+    Counter lock_losses;
+
+    Gauge locked;
+    Gauge peak_correlation;         ///< The strongest correlation of the code phase.
+    Gauge peak_to_mean;             ///< The above relative to the mean correlation or the noise floor.
+    Gauge clock_error_ppm;
+    Gauge overruns;                 ///< The sample overruns of the link; see rx::PHYSource::getOverrunCount().
+
+    Histogram<10> peak_correlation_histogram{0.0, 1.0};
+    Histogram<16> peak_to_mean_histogram{0.0, 32.0};
+};
+
+/// The timing of one precision timer (see side_channel_timer.hpp). The edge error is the delay of a chip edge or of
+/// the end of a sampling window after its deadline. The timer updates the metrics once per edge from one thread.
+struct TimerMetrics
+{
+    explicit TimerMetrics(std::string timer_name) : name(std::move(timer_name)) { }
+
+    const std::string name;
+
+    Counter edges;
+    Counter edge_error_sum_ns;
+    Gauge max_edge_error_ns;
+    Gauge margin_ns;                ///< The margin of the sleep before the deadline that is spun; see PrecisionTimer.
+
+    Histogram<20> edge_error_histogram{0.0, 20'000.0};     ///< In nanoseconds.
+};
+
+/// The links are registered once at startup; the references remain valid for the lifetime of the registry.
+class Registry
+{
+public:
+    /// Thread-safe.
+    LinkMetrics& add(std::string name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return links_.emplace_back(std::move(name));
+    }
+
+    /// Thread-safe.
+    TimerMetrics& addTimer(std::string name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return timers_.emplace_back(std::move(name));
+    }
+
+    /// Thread-safe.
+    template <typename F>
+    void forEach(const F& fun) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& l : links_)
+        {
+            fun(l);
+        }
+    }
+
+    /// Thread-safe.
+    template <typename F>
+    void forEachTimer(const F& fun) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& t : timers_)
+        {
+            fun(t);
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<LinkMetrics> links_;
+    std::deque<TimerMetrics> timers_;
+};
+
+template <std::size_t BinCount>
+inline void format(std::string& out, const char* const key, const Histogram<BinCount>& histogram)
+{
+    char buf[64]{};
+    (void)std::snprintf(buf, sizeof(buf), " %s[%g,%g)=", key, histogram.getMin(), histogram.getMax());
+    out += buf;
+    for (auto i = 0U; i < histogram.size(); i++)
+    {
+        (void)std::snprintf(buf, sizeof(buf), (i > 0) ? ",%llu" : "%llu",
+                            static_cast<unsigned long long>(histogram.get(i)));
+        out += buf;
+    }
+}
+
+/// One line of space-separated key=value pairs; see the overload for the registry below.
+inline std::string format(const TimerMetrics& m)
+{
+    const auto edges = m.edges.get();
+    char buf[256]{};
+    (void)std::snprintf(buf, sizeof(buf), "%s: edges=%llu mean_edge_error=%.0fns max_edge_error=%.0fns margin=%.0fns",
+                        m.name.c_str(),
+                        static_cast<unsigned long long>(edges),
+                        (edges > 0U) ? (double(m.edge_error_sum_ns.get()) / double(edges)) : 0.0,
+                        m.max_edge_error_ns.get(),
+                        m.margin_ns.get());
+    std::string out(buf);
+    format(out, "edge_error_histogram", m.edge_error_histogram);
+    return out;
+}
+
+/// One line per link of space-separated key=value pairs, followed by one line per timer; the histograms are
+/// comma-separated bin counts.
+inline std::string format(const Registry& registry)
+{
+    std::string out;
+    registry.forEach([&out](const LinkMetrics& m)
+    {
+        char buf[512]{};
+        (void)std::snprintf(buf, sizeof(buf),
+                            "%s: bits=%llu frames=%llu header_crc_errors=%llu fec_errors=%llu crc_errors=%llu "
+                            "lock_acquisitions=%llu lock_losses=%llu locked=%.0f peak=%.3f peak_to_mean=%.1f "
+                            "clock=%+.1fppm overruns=%.0f",
+                            m.name.c_str(),
+                            static_cast<unsigned long long>(m.bits.get()),
+                            static_cast<unsigned long long>(m.frames.get()),
+                            static_cast<unsigned long long>(m.header_crc_errors.get()),
+                            static_cast<unsigned long long>(m.fec_errors.get()),
+                            static_cast<unsigned long long>(m.crc_errors.get()),
+                            static_cast<unsigned long long>(m.lock_acquisitions.get()),
+                            static_cast<unsigned long long>(m.lock_losses.get()),
+                            m.locked.get(),
+                            m.peak_correlation.get(),
+                            m.peak_to_mean.get(),
+                            m.clock_error_ppm.get(),
+                            m.overruns.get());
+        out += buf;
+        format(out, "peak_histogram", m.peak_correlation_histogram);
+        format(out, "peak_to_mean_histogram", m.peak_to_mean_histogram);
+        out += "\n";
+    });
+    registry.forEachTimer([&out](const TimerMetrics& m) { out += format(m) + "\n"; });
+    return out;
+}
+
+/// Publishes the snapshots of the registry periodically from a separate thread: writes them into the file
+/// if the path is not empty, and prints them if requested. The last snapshot is published at destruction.
+class Publisher
+{
+public:
+    static constexpr std::chrono::seconds DefaultInterval{1};
+
+    Publisher(const Registry&                 registry,
+              std::string                     path,
+              const bool                      print,
+              const std::chrono::milliseconds interval = DefaultInterval) :
+        registry_(registry),
+        path_(std::move(path)),
+        print_(print),
+        interval_(interval)
+    {
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~Publisher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+private:
+    void run()
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        for (;;)
+        {
+            bool stop = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                (void)cv_.wait_for(lock, interval_, [this]() { return stop_; });
+                stop = stop_;
+            }
+            const double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+            char header[64]{};
+            (void)std::snprintf(header, sizeof(header), "uptime=%.1fs\n", uptime);
+            const auto snapshot = header + format(registry_);
+            if (!path_.empty())
+            {
+                write(snapshot);
+            }
+            if (print_)
+            {
+                std::fputs(snapshot.c_str(), stdout);
+                std::fflush(stdout);
+            }
+            if (stop)
+            {
+                break;
+            }
+        }
+    }
+
+    /// The snapshot is written into a temporary file that replaces the old one, so the readers never see a partial one.
+    void write(const std::string& snapshot) const
+    {
+        const auto tmp = path_ + ".tmp";
+        std::FILE* const f = std::fopen(tmp.c_str(), "w");
+        const bool ok = (f != nullptr) && (std::fputs(snapshot.c_str(), f) >= 0);
+        if ((f == nullptr) || (std::fclose(f) != 0) || !ok || (std::rename(tmp.c_str(), path_.c_str()) != 0))
+        {
+            std::fprintf(stderr, "Could not write the telemetry file %s\n", path_.c_str());
+        }
+    }
+
+    const Registry& registry_;
+    const std::string path_;
+    const bool print_;
+    const std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+}
@@ -0,0 +1,152 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The precision timer shared by the PHY driver of the transmitter and by the sampler of the receiver.
+/// The plain sleep overshoots the deadline by up to a scheduler tick, which is a large fraction of a chip, and the
+/// phase error of the chip edges attenuates the useful signal at the receiver. The timer therefore sleeps until
+/// a margin before the deadline and spins for the rest; the margin follows the observed wakeup latency of the host.
+/// The edge error (the delay of each edge after its deadline) is accounted in the telemetry.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_telemetry.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+namespace side_channel::timer
+{
+
+/// The initial margin is measured once per process; see PrecisionTimer::getCalibratedMargin().
+static constexpr auto CalibrationSleepCount = 16U;
+static constexpr auto CalibrationSleepDuration = std::chrono::microseconds(100);
+/// The margin is at least the minimum in case the wakeup latency is underestimated, and at most the maximum,
+/// because the timer spins for the whole margin, which would load the CPU during the low chips.
+static constexpr auto MinMargin = std::chrono::microseconds(5);
+static constexpr auto MaxMargin = std::chrono::microseconds(500);
+/// The margin is set to this multiple of the worst recent wakeup latency.
+static constexpr double MarginFactor = 1.5;
+/// The margin decays towards the wakeup latency by this fraction per sleep, so that a rare spike of the latency
+/// does not keep the timer spinning for long.
+static constexpr double MarginDecay = 1.0 / 256.0;
+
+/// Lets the sibling hyperthread run while spinning on the clock.
+inline void relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/// Not thread-safe; each thread that needs accurate timing shall use its own instance.
+class PrecisionTimer
+{
+public:
+    PrecisionTimer() : margin_ns_(double(getCalibratedMargin().count())) { }
+
+    /// The metrics are updated on every edge if set; the pointer shall remain valid while the timer is in use.
+    void setTelemetry(side_channel::telemetry::TimerMetrics* const metrics) { telemetry_ = metrics; }
+
+    /// Blocks until the deadline without loading the CPU except for the margin before it.
+    void sleepUntil(const side_channel::FastClock::time_point deadline)
+    {
+        const auto margin = std::chrono::nanoseconds(static_cast<std::int64_t>(margin_ns_));
+        const auto wake_at = deadline - margin;
+        if (side_channel::FastClock::now() < wake_at)
+        {
+            sleep(wake_at - side_channel::FastClock::now());
+            updateMargin(side_channel::FastClock::now() - wake_at);
+        }
+        while (side_channel::FastClock::now() < deadline)
+        {
+            relax();
+        }
+        record(deadline);
+    }
+
+    /// Invokes the load repeatedly until the deadline. The load shall return quickly because it is not preempted
+    /// at the deadline.
+    template <typename F>
+    void spinUntil(const side_channel::FastClock::time_point deadline, F&& load)
+    {
+        while (side_channel::FastClock::now() < deadline)
+        {
+            load();
+        }
+        record(deadline);
+    }
+
+    /// Accounts the edge scheduled at the deadline that is happening now. This is used if the deadline was awaited
+    /// by other means, such as by the counter threads of the sampler.
+    void record(const side_channel::FastClock::time_point deadline)
+    {
+        if (telemetry_ != nullptr)
+        {
+            const auto error_ns = std::max<std::int64_t>(0, (side_channel::FastClock::now() - deadline).count());
+            telemetry_->edges.add();
+            telemetry_->edge_error_sum_ns.add(static_cast<std::uint64_t>(error_ns));
+            telemetry_->max_edge_error_ns.set(std::max(telemetry_->max_edge_error_ns.get(), double(error_ns)));
+            telemetry_->margin_ns.set(margin_ns_);
+            telemetry_->edge_error_histogram.add(double(error_ns));
+        }
+    }
+
+    std::chrono::nanoseconds getMargin() const
+    {
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(margin_ns_));
+    }
+
+private:
+    /// The absolute deadline is immune to the accumulation of error if the sleep is interrupted by a signal.
+    /// The monotonic clock is not the same as the FastClock, so only the duration is carried over.
+    static void sleep(const std::chrono::nanoseconds duration)
+    {
+        timespec ts{};
+        (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+        const auto ns = std::int64_t(ts.tv_nsec) + std::max<std::int64_t>(0, duration.count());
+        ts.tv_sec += static_cast<time_t>(ns / 1'000'000'000);
+        ts.tv_nsec = static_cast<long>(ns % 1'000'000'000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+    }
+
+    /// The worst observed wakeup latency of a short sleep, scaled by the margin factor.
+    static std::chrono::nanoseconds getCalibratedMargin()
+    {
+        static const auto margin = []()
+        {
+            std::int64_t worst = 0;
+            for (auto i = 0U; i < CalibrationSleepCount; i++)
+            {
+                const auto started_at = side_channel::FastClock::now();
+                sleep(CalibrationSleepDuration);
+                worst = std::max<std::int64_t>(worst,
+                                               (side_channel::FastClock::now() - started_at - CalibrationSleepDuration)
+                                                   .count());
+            }
+            return std::clamp(std::chrono::nanoseconds(static_cast<std::int64_t>(double(worst) * MarginFactor)),
+                              std::chrono::nanoseconds(MinMargin),
+                              std::chrono::nanoseconds(MaxMargin));
+        }();
+        return margin;
+    }
+
+    void updateMargin(const std::chrono::nanoseconds latency)
+    {
+        const double target = double(latency.count()) * MarginFactor;
+        margin_ns_ = std::clamp(std::max(target, margin_ns_ - ((margin_ns_ - target) * MarginDecay)),
+                                double(std::chrono::nanoseconds(MinMargin).count()),
+                                double(std::chrono::nanoseconds(MaxMargin).count()));
+    }
+
+    double margin_ns_;
+    side_channel::telemetry::TimerMetrics* telemetry_ = nullptr;
+};
+
+}
@@ -0,0 +1,311 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The CPU topology of the host as described by /sys/devices/system/cpu: the SMT siblings of the physical cores,
+/// the domains of the last-level cache (e.g., the CCX of AMD processors), and the NUMA nodes.
+/// The PHY is placed on one hardware thread per physical core, because loading both SMT siblings of a core wastes
+/// power without making the signal any stronger, and preferably inside one cache domain, where the coupling between
+/// the cores is the strongest. The transmitter and the receiver on the same host arrive at the same layout
+/// if they use the same placement options; see side_channel::ExecutionProfile.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <dirent.h>
+#include <sched.h>
+
+namespace side_channel::topology
+{
+
+/// Parses the CPU list format of the kernel, e.g., "0-3,8,10-11". Throws std::invalid_argument if malformed.
+inline std::vector<unsigned> parseCPUList(const std::string& list)
+{
+    std::vector<unsigned> out;
+    std::size_t pos = 0;
+    while (pos < list.size())
+    {
+        const auto end = std::min(list.find(',', pos), list.size());
+        const auto item = list.substr(pos, end - pos);
+        const auto dash = item.find('-');
+        const auto first = static_cast<unsigned>(std::stoul(item.substr(0, dash)));
+        const auto last =
+            (dash == std::string::npos) ? first : static_cast<unsigned>(std::stoul(item.substr(dash + 1U)));
+        if (last < first)
+        {
+            throw std::invalid_argument("Invalid CPU range " + item);
+        }
+        for (auto cpu = first; cpu <= last; cpu++)
+        {
+            out.push_back(cpu);
+        }
+        pos = end + 1U;
+    }
+    return out;
+}
+
+/// One hardware thread. The physical core, the cache domain, and the NUMA node are identified by their lowest CPU
+/// (except the node, which has its own number), so that the IDs are unique across the packages.
+struct CPU
+{
+    unsigned id = 0;
+    unsigned core = 0;          ///< The lowest of the SMT siblings.
+    unsigned cache_domain = 0;  ///< The lowest CPU that shares the last-level cache with this one.
+    unsigned package = 0;
+    unsigned node = 0;
+};
+
+/// Only the CPUs that are online and allowed by the affinity mask of the process are included, in increasing order.
+struct Topology
+{
+    std::vector<CPU> cpus;
+
+    std::size_t getCoreCount() const { return countDistinct(&CPU::core); }
+    std::size_t getCacheDomainCount() const { return countDistinct(&CPU::cache_domain); }
+    std::size_t getNodeCount() const { return countDistinct(&CPU::node); }
+
+private:
+    std::size_t countDistinct(unsigned CPU::* const field) const
+    {
+        std::set<unsigned> out;
+        for (const auto& c : cpus)
+        {
+            out.insert(c.*field);
+        }
+        return out.size();
+    }
+};
+
+namespace detail
+{
+/// Empty if the file cannot be read.
+inline std::string readLine(const std::string& path)
+{
+    std::ifstream ifs(path);
+    std::string out;
+    std::getline(ifs, out);
+    return out;
+}
+
+/// The lowest CPU or the number in the file, or the fallback if the file cannot be read.
+inline unsigned readLowest(const std::string& path, const unsigned fallback, const bool list)
+{
+    try
+    {
+        const auto line = readLine(path);
+        if (!line.empty())
+        {
+            if (list)
+            {
+                const auto cpus = parseCPUList(line);
+                return cpus.empty() ? fallback : *std::min_element(std::begin(cpus), std::end(cpus));
+            }
+            return static_cast<unsigned>(std::stoul(line));
+        }
+    }
+    catch (const std::exception&)
+    {
+        // The format is not recognized; the fallback is sane in any case.
+    }
+    return fallback;
+}
+
+/// The lowest CPU that shares the last-level cache, i.e., the one of the highest level.
+inline unsigned findCacheDomain(const std::string& cpu_path, const unsigned fallback)
+{
+    unsigned best_level = 0;
+    unsigned out = fallback;
+    for (auto index = 0U;; index++)
+    {
+        const auto path = cpu_path + "/cache/index" + std::to_string(index);
+        const auto level = readLowest(path + "/level", 0, false);
+        if (level == 0)
+        {
+            break;
+        }
+        if (level >= best_level)
+        {
+            best_level = level;
+            out = readLowest(path + "/shared_cpu_list", fallback, true);
+        }
+    }
+    return out;
+}
+
+/// The NUMA node is a "nodeN" entry in the directory of the CPU.
+inline unsigned findNode(const std::string& cpu_path)
+{
+    unsigned out = 0;
+    if (DIR* const dir = opendir(cpu_path.c_str()))
+    {
+        while (const dirent* const entry = readdir(dir))
+        {
+            const std::string name(entry->d_name);
+            if ((name.size() > 4U) && (name.rfind("node", 0) == 0) &&
+                (name.find_first_not_of("0123456789", 4) == std::string::npos))
+            {
+                out = static_cast<unsigned>(std::stoul(name.substr(4)));
+                break;
+            }
+        }
+        (void)closedir(dir);
+    }
+    return out;
+}
+}
+
+/// Discovers the topology at the specified sysfs root. If the root is not readable, e.g., in a container that does
+/// not expose it, every CPU is assumed to be a physical core of its own in one cache domain.
+inline Topology discover(const std::string& root = "/sys/devices/system/cpu")
+{
+    std::vector<unsigned> online;
+    try
+    {
+        online = parseCPUList(detail::readLine(root + "/online"));
+    }
+    catch (const std::exception&)
+    {
+        online.clear();
+    }
+    if (online.empty())
+    {
+        for (auto i = 0U; i < std::max(1U, std::thread::hardware_concurrency()); i++)
+        {
+            online.push_back(i);
+        }
+    }
+    cpu_set_t allowed{};
+    CPU_ZERO(&allowed);
+    const bool have_affinity = 0 == sched_getaffinity(0, sizeof(allowed), &allowed);
+    Topology out;
+    for (auto id : online)
+    {
+        if (have_affinity && ((id >= CPU_SETSIZE) || !CPU_ISSET(id, &allowed)))
+        {
+            continue;
+        }
+        const auto path = root + "/cpu" + std::to_string(id);
+        CPU c;
+        c.id = id;
+        c.core = detail::readLowest(path + "/topology/thread_siblings_list", id, true);
+        c.package = detail::readLowest(path + "/topology/physical_package_id", 0, false);
+        c.cache_domain = detail::findCacheDomain(path, c.core);
+        c.node = detail::findNode(path);
+        out.cpus.push_back(c);
+    }
+    return out;
+}
+
+/// The topology of the local host is discovered once.
+inline const Topology& getTopology()
+{
+    static const Topology topology = discover();
+    return topology;
+}
+
+enum class Placement
+{
+    All,            ///< Every hardware thread, in the order of the CPU numbers.
+    Cores,          ///< One hardware thread per physical core in all cache domains.
+    CacheDomain,    ///< One hardware thread per physical core in the cache domain with the most cores.
+};
+
+/// Returns an empty option if the name is unknown.
+inline std::optional<Placement> findPlacement(const std::string& name)
+{
+    if (name == "all")
+    {
+        return Placement::All;
+    }
+    if (name == "cores")
+    {
+        return Placement::Cores;
+    }
+    if (name == "domain")
+    {
+        return Placement::CacheDomain;
+    }
+    return {};
+}
+
+inline const char* getPlacementName(const Placement placement)
+{
+    switch (placement)
+    {
+    case Placement::All:         return "all";
+    case Placement::Cores:       return "cores";
+    case Placement::CacheDomain: return "domain";
+    }
+    return "?";
+}
+
+/// The CPUs for the PHY cores in the order of the PHY core index, at most max_count of them. The physical cores
+/// are grouped by the NUMA node and the cache domain, so that the neighboring PHY cores (i.e., the cores of one
+/// lane; see side_channel_lanes.hpp) are close to each other. The first hardware thread of each physical core is
+/// used. The ties between the cache domains are resolved in favor of the lowest CPU, so that the result is
+/// deterministic.
+inline std::vector<unsigned> selectCPUs(const Topology&   topology,
+                                        const Placement   placement,
+                                        const std::size_t max_count)
+{
+    auto cpus = topology.cpus;
+    if (placement != Placement::All)
+    {
+        std::map<unsigned, CPU> cores;     // The first hardware thread of each core; the CPUs are in order.
+        for (const auto& c : cpus)
+        {
+            (void)cores.emplace(c.core, c);
+        }
+        cpus.clear();
+        for (const auto& [core, c] : cores)
+        {
+            cpus.push_back(c);
+        }
+        std::sort(std::begin(cpus), std::end(cpus), [](const CPU& a, const CPU& b)
+        {
+            return std::tie(a.node, a.cache_domain, a.id) < std::tie(b.node, b.cache_domain, b.id);
+        });
+    }
+    if ((placement == Placement::CacheDomain) && !cpus.empty())
+    {
+        std::map<unsigned, std::size_t> sizes;
+        for (const auto& c : cpus)
+        {
+            sizes[c.cache_domain]++;
+        }
+        const auto largest = std::max_element(std::begin(sizes), std::end(sizes),
+                                              [](const auto& a, const auto& b) { return a.second < b.second; });
+        const auto domain = largest->first;
+        cpus.erase(std::remove_if(std::begin(cpus), std::end(cpus),
+                                  [domain](const CPU& c) { return c.cache_domain != domain; }),
+                   std::end(cpus));
+    }
+    std::vector<unsigned> out;
+    for (const auto& c : cpus)
+    {
+        if (out.size() < max_count)
+        {
+            out.push_back(c.id);
+        }
+    }
+    return out;
+}
+
+/// For the diagnostics.
+inline std::string describe(const Topology& topology)
+{
+    return std::to_string(topology.cpus.size()) + " CPUs, " + std::to_string(topology.getCoreCount()) +
+           " cores, " + std::to_string(topology.getCacheDomainCount()) + " cache domains, " +
+           std::to_string(topology.getNodeCount()) + " NUMA nodes";
+}
+
+}
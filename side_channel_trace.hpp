@@ -0,0 +1,225 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// Traces of the raw PHY measurements: the receiver can record the output of the sampler into a file (rx --trace),
+/// which can be replayed offline through the same decoding pipeline as fast as the CPU allows (see replay.cpp).
+/// This makes the changes to the correlator and the framing testable without live runs that take tens of minutes.
+///
+/// The file begins with the header, followed by the records, one per sampling window:
+///     int64   timestamp_ns    The end of the sampling window (see side_channel::FastClock).
+///     float32 elapsed_ns      The actual duration of the window.
+///     uint32  count[N]        The tick count of each core; N is specified in the header.
+/// The byte order is that of the host, so the traces are not portable between hosts of different endianness.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace side_channel::trace
+{
+
+struct FileHeader
+{
+    static constexpr std::uint32_t Magic   = 0x52544353U;   ///< "SCTR" in the little endian byte order.
+    static constexpr std::uint16_t Version = 1;
+
+    std::uint32_t magic = Magic;
+    std::uint16_t version = Version;
+    std::uint16_t core_count = 0;
+    std::uint32_t sample_duration_ns = 0;   ///< The nominal duration of the sampling window of the recorder.
+};
+static_assert(sizeof(FileHeader) == 12);
+
+inline std::size_t getRecordSize(const std::size_t core_count)
+{
+    return sizeof(std::int64_t) + sizeof(float) + (core_count * sizeof(std::uint32_t));
+}
+
+/// Records the measurements into a new file. The records are accumulated in memory and written out by a separate
+/// thread, so that the disk I/O does not delay the sampler thread that calls write().
+class Writer
+{
+public:
+    /// Throws std::runtime_error if the file cannot be created.
+    Writer(const std::string& path, const unsigned core_count, const std::chrono::nanoseconds sample_duration) :
+        core_count_(core_count),
+        file_(std::fopen(path.c_str(), "wb"))
+    {
+        if (file_ == nullptr)
+        {
+            throw std::runtime_error("Cannot create trace file " + path);
+        }
+        FileHeader header;
+        header.core_count = static_cast<std::uint16_t>(core_count);
+        header.sample_duration_ns = static_cast<std::uint32_t>(sample_duration.count());
+        (void)std::fwrite(&header, sizeof(header), 1, file_);
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    /// The buffered records are written out before the file is closed.
+    ~Writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        (void)std::fclose(file_);
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    /// The counts are indexed by core; the missing ones are recorded as zero. Thread-safe.
+    void write(const std::int64_t timestamp_ns, const float elapsed_ns, const std::vector<std::int64_t>& counts)
+    {
+        bool flush = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto offset = pending_.size();
+            pending_.resize(offset + getRecordSize(core_count_), 0);
+            std::uint8_t* const record = pending_.data() + offset;
+            std::memcpy(record, &timestamp_ns, sizeof(timestamp_ns));
+            std::memcpy(record + sizeof(timestamp_ns), &elapsed_ns, sizeof(elapsed_ns));
+            for (std::size_t i = 0; (i < core_count_) && (i < counts.size()); i++)
+            {
+                const auto c = static_cast<std::uint32_t>(
+                    std::clamp<std::int64_t>(counts[i], 0, std::numeric_limits<std::uint32_t>::max()));
+                std::memcpy(record + sizeof(timestamp_ns) + sizeof(elapsed_ns) + (i * sizeof(c)), &c, sizeof(c));
+            }
+            flush = pending_.size() >= FlushThreshold;
+        }
+        if (flush)
+        {
+            cv_.notify_one();
+        }
+    }
+
+private:
+    /// The writer thread is woken up once this many bytes are pending rather than at every record, and also
+    /// periodically, so that little is lost if the recorder is killed.
+    static constexpr std::size_t FlushThreshold = 64 * 1024;
+    static constexpr std::chrono::seconds FlushInterval{1};
+
+    void run()
+    {
+        std::vector<std::uint8_t> buffer;
+        for (;;)
+        {
+            bool stop = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                (void)cv_.wait_for(lock, FlushInterval,
+                                   [this]() { return stop_ || (pending_.size() >= FlushThreshold); });
+                buffer.swap(pending_);
+                stop = stop_;
+            }
+            if (!buffer.empty() && (std::fwrite(buffer.data(), buffer.size(), 1, file_) != 1U))
+            {
+                std::fprintf(stderr, "Could not write the trace file\n");
+            }
+            (void)std::fflush(file_);
+            buffer.clear();
+            if (stop)
+            {
+                break;
+            }
+        }
+    }
+
+    const std::size_t core_count_;
+    std::FILE* const file_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::uint8_t> pending_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+/// Maps the trace file into memory read-only, so that any number of threads can replay it at once.
+class Reader
+{
+public:
+    /// Throws std::runtime_error if the file cannot be read or is not a valid trace.
+    explicit Reader(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st{};
+        if ((fd < 0) || (::fstat(fd, &st) != 0) || (static_cast<std::size_t>(st.st_size) < sizeof(FileHeader)))
+        {
+            if (fd >= 0)
+            {
+                (void)::close(fd);
+            }
+            throw std::runtime_error("Cannot read trace file " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void* const data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        (void)::close(fd);
+        if (data == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map trace file " + path);
+        }
+        data_ = static_cast<const std::uint8_t*>(data);
+        (void)::madvise(const_cast<std::uint8_t*>(data_), size_, MADV_SEQUENTIAL);
+        std::memcpy(&header_, data_, sizeof(header_));
+        if ((header_.magic != FileHeader::Magic) || (header_.version != FileHeader::Version) ||
+            (header_.core_count == 0U))
+        {
+            (void)::munmap(const_cast<std::uint8_t*>(data_), size_);
+            throw std::runtime_error("Not a valid trace file " + path);
+        }
+        record_size_ = getRecordSize(header_.core_count);
+    }
+
+    ~Reader() { (void)::munmap(const_cast<std::uint8_t*>(data_), size_); }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    unsigned getCoreCount() const { return header_.core_count; }
+    std::chrono::nanoseconds getSampleDuration() const { return std::chrono::nanoseconds(header_.sample_duration_ns); }
+
+    /// The number of complete records; a partially written record at the end is ignored.
+    std::size_t size() const { return (size_ - sizeof(FileHeader)) / record_size_; }
+
+    std::int64_t getTimestamp(const std::size_t index) const { return get<std::int64_t>(index, 0); }
+    float getElapsed(const std::size_t index) const { return get<float>(index, sizeof(std::int64_t)); }
+    std::uint32_t getCount(const std::size_t index, const unsigned core) const
+    {
+        return get<std::uint32_t>(index, sizeof(std::int64_t) + sizeof(float) + (core * sizeof(std::uint32_t)));
+    }
+
+private:
+    /// The fields are not aligned.
+    template <typename T>
+    T get(const std::size_t index, const std::size_t offset) const
+    {
+        T out{};
+        std::memcpy(&out, data_ + sizeof(FileHeader) + (index * record_size_) + offset, sizeof(T));
+        return out;
+    }
+
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t record_size_ = 0;
+    FileHeader header_;
+};
+
+}
@@ -0,0 +1,495 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+///
+/// The transmitting side of the link: the PHY driver, the modulator, and the framing of the bursts.
+/// It is used by the transmitter, and also by the receiver to send the acknowledgements over the reverse channel
+/// (see side_channel_arq.hpp). The application that cannot block on the transmission uses the SendQueue.
+
+#pragma once
+
+#include "side_channel_params.hpp"
+#include "side_channel_backend.hpp"
+#include "side_channel_crc.hpp"
+#include "side_channel_fec.hpp"
+#include "side_channel_telemetry.hpp"
+#include "side_channel_timer.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
+
+namespace side_channel::tx
+{
+
+/// A resident pool of load generator threads, each pinned to its own core. The workers spin while the level is high
+/// and park on a futex while it is low, so that a chip edge is seen by all cores at once, without the thread
+/// startup ramp at the leading edge and the join delay at the trailing edge.
+/// The load is that of the backend of the PHY; see side_channel_backend.hpp.
+template <typename Backend>
+class LoadPool
+{
+public:
+    explicit LoadPool(const std::vector<unsigned>& cores)
+    {
+        for (auto core : cores)
+        {
+            threads_.emplace_back([this, core]() { run(core); });
+        }
+    }
+
+    ~LoadPool()
+    {
+        level_.store(Stop, std::memory_order_release);
+        side_channel::futexWakeAll(level_);
+        for (auto& t : threads_)
+        {
+            t.join();
+        }
+    }
+
+    LoadPool(const LoadPool&) = delete;
+    LoadPool& operator=(const LoadPool&) = delete;
+
+    void setLevel(const bool level)
+    {
+        const auto prev = level_.exchange(level ? High : Low, std::memory_order_release);
+        if (level && (prev != High))
+        {
+            side_channel::futexWakeAll(level_);
+        }
+    }
+
+private:
+    static constexpr std::uint32_t Low  = 0;
+    static constexpr std::uint32_t High = 1;
+    static constexpr std::uint32_t Stop = 2;
+
+    void run(const unsigned core)
+    {
+        side_channel::initThread(core);
+        typename Backend::Load load;
+        for (;;)
+        {
+            const auto level = level_.load(std::memory_order_acquire);
+            if (level == Stop)
+            {
+                break;
+            }
+            if (level == High)
+            {
+                // Short bursts of load between the checks keep the reaction to the trailing edge quick.
+                load();
+            }
+            else
+            {
+                side_channel::futexWait(level_, Low);
+            }
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    alignas(64) std::atomic<std::uint32_t> level_{Low};
+};
+
+/// Drives the PHY of one lane (see side_channel_lanes.hpp). The first core of the lane is left to the calling
+/// thread, which generates the load itself; the other cores of the lane are loaded by the resident pool.
+/// The chip edges are timed by the precision timer, which sleeps through the low chips; see side_channel_timer.hpp.
+/// The driver is specialized on the backend of the PHY, which defines the load; see side_channel_backend.hpp.
+template <typename Backend = side_channel::backend::Default>
+class BasicPHYDriver
+{
+public:
+    /// The modulator prints the transmitted bytes if the driver is verbose; see emitByte().
+    static constexpr bool Verbose = true;
+
+    explicit BasicPHYDriver(const std::vector<unsigned>& cores) :
+        pool_({std::begin(cores) + 1, std::end(cores)})
+    { }
+
+    /// The chip edge errors are accounted in the metrics if set; see timer::PrecisionTimer::setTelemetry().
+    void setTelemetry(side_channel::telemetry::TimerMetrics* const metrics) { timer_.setTelemetry(metrics); }
+
+    void drive(const bool level, const std::chrono::nanoseconds duration)
+    {
+        // Use delta relative to fixed state to avoid accumulation of phase error, because phase error attenuates the
+        // useful signal at the receiver.
+        deadline_ += duration;
+        pool_.setLevel(level);
+        if (level)
+        {
+            // Short bursts of load between the checks keep the core busy in case now() is blocking,
+            // without delaying the trailing edge.
+            timer_.spinUntil(deadline_, load_);
+        }
+        else
+        {
+            timer_.sleepUntil(deadline_);
+        }
+    }
+
+private:
+    LoadPool<Backend> pool_;
+    typename Backend::Load load_;
+    side_channel::timer::PrecisionTimer timer_;
+    side_channel::FastClock::time_point deadline_ = side_channel::FastClock::now();
+};
+
+/// The driver of the backend selected at build time.
+using PHYDriver = BasicPHYDriver<>;
+
+/// The modulator is specialized on the link profile, so that the code length and the chip period are known
+/// at compile time. In the M-ary mode, the bits are accumulated until there is enough for a whole symbol.
+/// The driver is anything with the drive() method and the Verbose flag of PHYDriver, e.g., a simulated channel.
+template <typename Profile, typename Driver = PHYDriver>
+class Modulator
+{
+public:
+    Modulator(Driver& driver, const unsigned prn) : driver_(driver), code_(Profile::getCode(prn)) { }
+
+    void emitBit(const bool value)
+    {
+        symbol_ = (symbol_ << 1U) | (value ? 1U : 0U);
+        if (++symbol_bit_count_ >= Profile::SymbolBits)
+        {
+            emitSymbol(symbol_);
+            symbol_ = 0;
+            symbol_bit_count_ = 0;
+        }
+    }
+
+    /// Pads the last symbol with zero bits, which the receiver treats as a part of the postamble.
+    void flush()
+    {
+        while (symbol_bit_count_ > 0)
+        {
+            emitBit(false);
+        }
+    }
+
+private:
+    /// The first bit of the symbol is the polarity, the remaining bits are the cyclic shift of the code.
+    void emitSymbol(const std::uint32_t symbol)
+    {
+        const bool polarity = ((symbol >> Profile::ShiftBits) & 1U) != 0U;
+        const auto shift = (symbol & ((1U << Profile::ShiftBits) - 1U)) * Profile::ShiftSpacing;
+        for (auto i = 0U; i < Profile::CodeLength; i++)
+        {
+            const bool code_position = code_[(i + shift) % Profile::CodeLength];
+            const bool bit = polarity ? code_position : !code_position;
+            driver_.drive(bit, Profile::ChipPeriod);
+        }
+    }
+
+    Driver& driver_;
+    const typename Profile::Code& code_;
+    std::uint32_t symbol_ = 0;
+    std::uint32_t symbol_bit_count_ = 0;
+};
+
+/// The bits are transmitted MSB first.
+template <typename Profile, typename Driver>
+inline void emitBits(Modulator<Profile, Driver>& modulator, const std::uint32_t value, const std::uint32_t bit_count)
+{
+    auto i = bit_count;
+    while (i --> 0)
+    {
+        modulator.emitBit(((value >> i) & 1U) != 0U);
+    }
+}
+
+template <typename Profile, typename Driver>
+inline void emitByte(Modulator<Profile, Driver>& modulator, const std::uint8_t data)
+{
+    if constexpr (Driver::Verbose)
+    {
+        std::printf("byte 0x%02x\n", data);
+    }
+    emitBits(modulator, data, 8U);
+}
+
+/// The preamble length is specified in symbols; see side_channel::params::PreambleLength.
+template <typename Profile, typename Driver>
+inline void emitPreamble(Modulator<Profile, Driver>& modulator, const std::uint32_t length)
+{
+    if constexpr (Driver::Verbose)
+    {
+        std::printf("preamble\n");
+    }
+    for (auto i = 0U; i < (length * Profile::SymbolBits); i++)
+    {
+        modulator.emitBit(0);
+    }
+}
+
+/// The last symbol is completed before the postamble, so that the postamble consists of whole symbols.
+template <typename Profile, typename Driver>
+inline void emitPostamble(Modulator<Profile, Driver>& modulator)
+{
+    modulator.flush();
+    for (auto i = 0U; i < (side_channel::params::PostambleLength * Profile::SymbolBits); i++)
+    {
+        modulator.emitBit(0);
+    }
+    if constexpr (Driver::Verbose)
+    {
+        std::printf("postamble\n");
+    }
+}
+
+/// The frame begins with the header byte (CRC kind, FEC kind, and frame type); the body contains the data
+/// followed by the CRC of the header byte and the data (big endian). The body is encoded by the FEC;
+/// the CRC is computed before the encoding.
+inline std::vector<std::uint8_t> makeFrame(const side_channel::params::FrameType type,
+                                           const std::vector<std::uint8_t>&  data,
+                                           const side_channel::crc::Kind     crc_kind,
+                                           const side_channel::fec::Kind     fec_kind)
+{
+    std::vector<std::uint8_t> frame;
+    frame.reserve(data.size() + 5U);
+    frame.push_back(static_cast<std::uint8_t>(static_cast<std::uint8_t>(crc_kind) |
+                                              (static_cast<std::uint8_t>(fec_kind) << 2U) |
+                                              (static_cast<std::uint8_t>(type) << 4U)));
+    frame.insert(std::end(frame), std::begin(data), std::end(data));
+    const auto crc = side_channel::crc::compute(crc_kind, frame.data(), frame.size());
+    frame.insert(std::end(frame), std::begin(crc), std::end(crc));
+    auto out = side_channel::fec::encode(fec_kind, frame.data() + 1, frame.size() - 1U);
+    if (out.size() > side_channel::params::MaxFrameBodySize)
+    {
+        throw std::length_error("The frame is too large: " + std::to_string(out.size()) + " bytes");
+    }
+    out.insert(std::begin(out), frame.front());
+    return out;
+}
+
+/// The frame is the output of makeFrame(). The header byte is followed by the size of the body and the header CRC.
+/// There are no start bits or delimiters because the receiver finds the frame by its sync word and knows its size.
+template <typename Profile, typename Driver>
+inline void emitFrame(Modulator<Profile, Driver>& modulator, const std::vector<std::uint8_t>& frame)
+{
+    using side_channel::params::SyncWord;
+    using side_channel::params::SyncWordLength;
+    const auto body_size = static_cast<std::uint16_t>(frame.size() - 1U);
+    const std::array<std::uint8_t, 3> header{
+        frame.front(),
+        static_cast<std::uint8_t>(body_size >> 8U),
+        static_cast<std::uint8_t>(body_size),
+    };
+    side_channel::crc::CRC16CCITT header_crc;
+    header_crc.add(header.data(), header.size());
+    emitBits(modulator, SyncWord, SyncWordLength);
+    for (std::uint8_t v : header)
+    {
+        emitByte(modulator, v);
+    }
+    for (std::uint8_t v : header_crc.getBytes())
+    {
+        emitByte(modulator, v);
+    }
+    for (auto it = std::begin(frame) + 1; it != std::end(frame); ++it)
+    {
+        emitByte(modulator, *it);
+    }
+}
+
+/// The frames of a burst are sent back-to-back using the same profile, with the preamble before the first frame
+/// only, because the receiver remains locked. Profiles other than the robust one are announced using the robust
+/// profile first, so that the receiver could switch its correlator to the announced profile for the burst.
+/// The preamble length is specified in symbols of the respective profile.
+template <typename Profile, typename Driver>
+inline void emitBurst(Driver&                                       driver,
+                      const unsigned                                prn,
+                      const std::vector<std::vector<std::uint8_t>>& frames,
+                      const side_channel::fec::Kind                 fec_kind,
+                      const std::uint8_t                            preamble_length)
+{
+    using side_channel::params::FrameType;
+    using side_channel::params::RobustProfile;
+    if constexpr (!std::is_same_v<Profile, RobustProfile>)
+    {
+        std::uint32_t size = 0;
+        for (const auto& f : frames)
+        {
+            size += static_cast<std::uint32_t>(f.size() - 1U);
+        }
+        const auto count = static_cast<std::uint16_t>(frames.size());
+        const std::vector<std::uint8_t> announcement{
+            side_channel::params::getProfileID<Profile>(),
+            static_cast<std::uint8_t>(size >> 24U),
+            static_cast<std::uint8_t>(size >> 16U),
+            static_cast<std::uint8_t>(size >> 8U),
+            static_cast<std::uint8_t>(size),
+            preamble_length,
+            static_cast<std::uint8_t>(count >> 8U),
+            static_cast<std::uint8_t>(count),
+        };
+        if constexpr (Driver::Verbose)
+        {
+            std::printf("announcing profile %s for %u frames\n", Profile::Name, static_cast<unsigned>(count));
+        }
+        Modulator<RobustProfile, Driver> modulator(driver, prn);
+        emitPreamble(modulator, preamble_length);
+        emitFrame(modulator,
+                  makeFrame(FrameType::ProfileAnnouncement,
+                            announcement,
+                            side_channel::crc::Kind::CRC16CCITT,
+                            fec_kind));
+        emitPostamble(modulator);
+    }
+    Modulator<Profile, Driver> modulator(driver, prn);
+    emitPreamble(modulator, preamble_length);
+    for (const auto& f : frames)
+    {
+        emitFrame(modulator, f);
+    }
+    emitPostamble(modulator);
+}
+
+/// Transmits the queued packets from a worker thread, so that the application is never blocked by the transmission.
+/// The frames are built when queued; the worker sends them in bursts: every burst carries the frames queued by
+/// the time it begins, up to the limit, so a backlog is drained with one preamble (and announcement) per burst.
+/// The worker owns the lane: it is pinned to the first PHY core of the lane, and the PHY driver is created anew for
+/// every burst, because its deadline shall not lag behind (see emitFileARQ() in tx.cpp).
+class SendQueue
+{
+public:
+    static constexpr std::size_t DefaultCapacity = 64;
+    /// The announcement is limited to 65535 frames, and the longer the burst, the longer the receiver waits for it.
+    static constexpr std::size_t MaxBurstFrames = 16;
+
+    /// The cores are the PHY cores of the lane; see side_channel::lanes::getLaneCores(). Throws std::invalid_argument
+    /// if the PRN number is not valid for the profile.
+    SendQueue(std::vector<unsigned>                  cores,
+              const unsigned                         prn,
+              const side_channel::params::Profile&   profile,
+              const side_channel::fec::Kind          fec_kind,
+              const std::uint8_t                     preamble_length = side_channel::params::PreambleLength,
+              const std::size_t                      capacity = DefaultCapacity) :
+        cores_(std::move(cores)),
+        prn_(prn),
+        profile_(profile),
+        fec_kind_(fec_kind),
+        preamble_length_(preamble_length),
+        capacity_(capacity)
+    {
+        std::visit([prn](auto p)
+        {
+            (void) decltype(p)::getCode(prn);
+            (void) side_channel::params::RobustProfile::getCode(prn);
+        }, profile);
+        if (cores_.empty())
+        {
+            throw std::invalid_argument("The lane has no cores");
+        }
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    /// The frames that are still queued are discarded; the burst in progress is completed.
+    ~SendQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    /// The chip edge errors of the bursts are accounted in the metrics if set; see PHYDriver::setTelemetry().
+    /// Shall be set before the first packet is queued.
+    void setTelemetry(side_channel::telemetry::TimerMetrics* const metrics) { telemetry_ = metrics; }
+
+    /// Never blocks. Returns false if the queue is full, in which case the packet is not queued.
+    /// Throws std::length_error if the packet does not fit into a frame; see makeFrame().
+    bool push(const side_channel::params::FrameType type,
+              const std::vector<std::uint8_t>&      data,
+              const side_channel::crc::Kind         crc_kind = side_channel::crc::Kind::CRC16CCITT)
+    {
+        auto frame = makeFrame(type, data, crc_kind, fec_kind_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.size() >= capacity_)
+            {
+                return false;
+            }
+            queue_.push_back(std::move(frame));
+        }
+        cv_.notify_all();
+        return true;
+    }
+
+    /// The number of the packets that are queued or being transmitted; zero once all of them have been sent.
+    std::size_t getPendingCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size() + in_flight_;
+    }
+
+    /// Blocks until all queued packets have been sent.
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return queue_.empty() && (in_flight_ == 0U); });
+    }
+
+private:
+    void run()
+    {
+        side_channel::initThread(cores_.front());
+        std::vector<std::vector<std::uint8_t>> frames;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                in_flight_ = 0;
+                cv_.notify_all();
+                cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (stop_)
+                {
+                    break;
+                }
+                frames.clear();
+                while (!queue_.empty() && (frames.size() < MaxBurstFrames))
+                {
+                    frames.push_back(std::move(queue_.front()));
+                    queue_.pop_front();
+                }
+                in_flight_ = frames.size();
+            }
+            PHYDriver driver(cores_);
+            driver.setTelemetry(telemetry_);
+            std::visit([&](auto p)
+            {
+                emitBurst<decltype(p)>(driver, prn_, frames, fec_kind_, preamble_length_);
+            }, profile_);
+        }
+    }
+
+    const std::vector<unsigned> cores_;
+    const unsigned prn_;
+    const side_channel::params::Profile profile_;
+    const side_channel::fec::Kind fec_kind_;
+    const std::uint8_t preamble_length_;
+    const std::size_t capacity_;
+    side_channel::telemetry::TimerMetrics* telemetry_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<std::uint8_t>> queue_;
+    std::size_t in_flight_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+}
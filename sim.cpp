@@ -0,0 +1,440 @@
+/// Pavel Kirienko <pavel@uavcan.org>
+/// Distributed under the terms of the MIT license.
+/// g++ -std=c++17 -O2 -march=native -Wall sim.cpp -lpthread -o sim && ./sim --profile=core
+///
+/// Simulates the link end to end without the hardware: the frames are modulated by the same code as in the
+/// transmitter, passed through a model of the channel with noise, edge jitter, and clock drift, and decoded by the same
+/// code as in the receiver. Prints the bit error rate and the goodput for each profile against its chip period.
+///
+/// The chip period is swept by dilating the time of the simulated channel by the specified scale factors, which is
+/// equivalent to building both sides with a proportionally longer side_channel::params::BaseChipPeriod: the pipeline
+/// does not depend on the time scale, unlike the impairments of the channel, which are specified in absolute terms.
+
+#include "side_channel_params.hpp"
+#include "side_channel_crc.hpp"
+#include "side_channel_fec.hpp"
+#include "side_channel_tx.hpp"
+#include "side_channel_rx.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+/// The impairments of the simulated channel.
+struct ChannelModel
+{
+    /// The standard deviation of the tick count of the receiver per sampling window of the nominal duration
+    /// (see side_channel::rx::SampleDuration) relative to the amplitude of the signal. The noise is white,
+    /// so its relative magnitude decreases as the square root of the window duration.
+    double noise = 0.0;
+    /// The standard deviation of the time of each edge of the transmitted signal.
+    std::chrono::nanoseconds jitter{0};
+    /// The frequency error of the transmitter clock relative to the receiver; positive if the transmitter is fast.
+    double drift_ppm = 0.0;
+};
+
+/// The receiver counts this many ticks per nanosecond when the PHY is idle.
+static constexpr double TickRate = 1.0;
+/// The fraction of the ticks of the receiver consumed by the transmitter when the PHY is driven high.
+static constexpr double LoadDepth = 0.5;
+
+/// Thrown by the simulated channel once the transmitted signal is exhausted.
+class EndOfSimulation : public std::runtime_error
+{
+public:
+    EndOfSimulation() : std::runtime_error("End of simulation") { }
+};
+
+/// Records the levels driven by the modulator as the edges of the signal in the time of the receiver.
+/// Only the edges where the level changes are stored, because the chips of the same level are indistinguishable.
+class SimulatedDriver
+{
+public:
+    static constexpr bool Verbose = false;
+
+    SimulatedDriver(const ChannelModel& model, const double scale, std::mt19937& rng) :
+        rate_(scale / (1.0 + (model.drift_ppm * 1e-6))),
+        jitter_(0.0, double(model.jitter.count())),
+        rng_(rng)
+    { }
+
+    void drive(const bool level, const std::chrono::nanoseconds duration)
+    {
+        if (edges_.empty() || (edges_.back().level != level))
+        {
+            // The edge is scheduled at the ideal time, so the jitter does not accumulate; see PHYDriver::drive().
+            const double at = std::max(now_ + jitter_(rng_), edges_.empty() ? 0.0 : edges_.back().at);
+            edges_.push_back({at, level});
+        }
+        now_ += double(duration.count()) * rate_;
+    }
+
+    /// The time when the last driven chip ends, in nanoseconds.
+    double getTime() const { return now_; }
+
+    struct Edge
+    {
+        double at = 0.0;
+        bool level = false;
+    };
+    const std::vector<Edge>& getEdges() const { return edges_; }
+
+private:
+    const double rate_;
+    std::normal_distribution<double> jitter_;
+    std::mt19937& rng_;
+    std::vector<Edge> edges_;
+    double now_ = 0.0;
+};
+
+/// Turns the recorded signal into the measurements of the receiver. The sampling windows follow the rate correction
+/// reported by the decoder like in the live receiver; see side_channel::rx::readPHY().
+class SimulatedChannel : public side_channel::rx::PHYSource
+{
+public:
+    SimulatedChannel(const SimulatedDriver& driver, const ChannelModel& model, const double scale, std::mt19937& rng) :
+        edges_(driver.getEdges()),
+        end_(driver.getTime()),
+        window_ns_(side_channel::rx::SampleDuration.count() * scale),
+        noise_(0.0, model.noise * LoadDepth * TickRate *
+                        std::sqrt(window_ns_ * side_channel::rx::SampleDuration.count())),
+        rng_(rng)
+    { }
+
+    side_channel::rx::PHYMeasurement next() override
+    {
+        const double duration = window_ns_ / (1.0 + rate_correction_);
+        const double started_at = now_;
+        now_ += duration;
+        if (now_ > end_)
+        {
+            throw EndOfSimulation();
+        }
+        const double high = getHighTime(started_at, now_);
+        const double count = (TickRate * duration) - (LoadDepth * TickRate * high) + noise_(rng_);
+        side_channel::rx::PHYMeasurement out;
+        out.timestamp = side_channel::FastClock::time_point(std::chrono::nanoseconds(std::int64_t(now_)));
+        out.count = std::max<std::int64_t>(0, std::llround(count));
+        out.elapsed_ns = duration;
+        return out;
+    }
+
+    std::uint64_t getOverrunCount() const override { return 0; }
+
+    void setRateCorrection(const double value) override { rate_correction_ = value; }
+
+private:
+    /// The windows are requested in order, so the edges are scanned once.
+    double getHighTime(const double from, const double to)
+    {
+        while (((edge_index_ + 1U) < edges_.size()) && (edges_[edge_index_ + 1U].at <= from))
+        {
+            edge_index_++;
+        }
+        double out = 0.0;
+        for (auto i = edge_index_; (i < edges_.size()) && (edges_[i].at < to); i++)
+        {
+            if (edges_[i].level)
+            {
+                const double next = ((i + 1U) < edges_.size()) ? edges_[i + 1U].at : end_;
+                out += std::max(0.0, std::min(next, to) - std::max(edges_[i].at, from));
+            }
+        }
+        return out;
+    }
+
+    const std::vector<SimulatedDriver::Edge>& edges_;
+    const double end_;
+    const double window_ns_;
+    std::normal_distribution<double> noise_;
+    std::mt19937& rng_;
+    std::size_t edge_index_ = 0;
+    double now_ = 0.0;
+    double rate_correction_ = 0.0;
+};
+
+struct Options
+{
+    std::vector<std::string> profiles;  ///< All profiles if empty.
+    std::vector<double> scales{1.0, 2.0, 4.0};
+    std::vector<double> noise_levels{0.5, 1.0, 2.0};
+    ChannelModel model;
+    unsigned frame_count = 8;
+    unsigned burst_size = 1;
+    std::size_t data_size = 16;
+    side_channel::fec::Kind fec_kind = side_channel::fec::Kind::None;
+    unsigned prn = 1;
+    unsigned seed = 42;
+};
+
+struct Result
+{
+    unsigned detected = 0;          ///< The frames found by the frame reader.
+    unsigned delivered = 0;         ///< The frames that passed the CRC check with the correct data.
+    std::uint64_t bit_count = 0;    ///< The body bits of the detected frames.
+    std::uint64_t bit_errors = 0;
+    double duration_s = 0.0;
+};
+
+/// The sent frame is the output of makeFrame(); it is matched to the received one by the time of its end.
+struct SentFrame
+{
+    std::vector<std::uint8_t> data;
+    std::vector<std::uint8_t> frame;
+    double end = 0.0;
+};
+
+/// The counterpart of the frame decoder of the receiver; see PacketReader.
+static std::optional<std::vector<std::uint8_t>> decode(const side_channel::rx::FrameReader::RawFrame& raw,
+                                                       const side_channel::fec::Kind                fec_kind)
+{
+    const auto crc_kind = side_channel::crc::Kind::CRC16CCITT;
+    std::vector<std::uint8_t> frame{raw.header};
+    if (fec_kind == side_channel::fec::Kind::None)
+    {
+        frame.insert(std::end(frame), std::begin(raw.body), std::end(raw.body));
+    }
+    else if (const auto decoded = side_channel::fec::decode(fec_kind, raw.soft.data(), raw.soft.size()))
+    {
+        frame.insert(std::end(frame), std::begin(*decoded), std::end(*decoded));
+    }
+    else
+    {
+        return {};
+    }
+    const auto crc_size = *side_channel::crc::getSize(crc_kind);
+    if ((frame.size() <= crc_size) || !side_channel::crc::check(crc_kind, frame.data(), frame.size()))
+    {
+        return {};
+    }
+    return std::vector<std::uint8_t>(std::begin(frame) + 1, std::end(frame) - static_cast<std::ptrdiff_t>(crc_size));
+}
+
+template <typename Profile>
+static Result simulate(const Options& options, const double scale, const double noise)
+{
+    using side_channel::params::FrameType;
+    std::mt19937 rng(options.seed);
+    ChannelModel model = options.model;
+    model.noise = noise;
+
+    SimulatedDriver driver(model, scale, rng);
+    std::vector<SentFrame> sent;
+    std::uniform_int_distribution<unsigned> byte_dist(0, 255);
+    while (sent.size() < options.frame_count)
+    {
+        side_channel::tx::Modulator<Profile, SimulatedDriver> modulator(driver, options.prn);
+        side_channel::tx::emitPreamble(modulator, side_channel::params::PreambleLength);
+        for (auto i = 0U; (i < options.burst_size) && (sent.size() < options.frame_count); i++)
+        {
+            SentFrame f;
+            f.data.resize(options.data_size);
+            for (auto& x : f.data)
+            {
+                x = static_cast<std::uint8_t>(byte_dist(rng));
+            }
+            f.frame = side_channel::tx::makeFrame(FrameType::Data,
+                                                  f.data,
+                                                  side_channel::crc::Kind::CRC16CCITT,
+                                                  options.fec_kind);
+            side_channel::tx::emitFrame(modulator, f.frame);
+            modulator.flush();
+            f.end = driver.getTime();
+            sent.push_back(std::move(f));
+        }
+        side_channel::tx::emitPostamble(modulator);
+    }
+    // Let the receiver flush the last bits out of its correlator.
+    for (auto i = 0U; i < (Profile::CodeLength * side_channel::params::PostambleLength); i++)
+    {
+        driver.drive(false, Profile::ChipPeriod);
+    }
+
+    SimulatedChannel channel(driver, model, scale, rng);
+    side_channel::rx::FrameReader reader(channel, options.prn, Profile::Name);
+    reader.setProfile(Profile{});
+    reader.setDiagnosticsEnabled(false);
+    const double tolerance = double(Profile::SymbolPeriod.count()) * scale * 2.0;
+    Result out;
+    out.duration_s = driver.getTime() * 1e-9;
+    std::vector<bool> matched(sent.size(), false);
+    try
+    {
+        for (;;)
+        {
+            const auto raw = reader.next();
+            if (!raw)
+            {
+                continue;
+            }
+            const double at = double(reader.getBitReader().getTime().time_since_epoch().count());
+            auto best = sent.size();
+            for (std::size_t i = 0; i < sent.size(); i++)
+            {
+                if (!matched[i] && (std::abs(sent[i].end - at) < tolerance) &&
+                    ((best == sent.size()) || (std::abs(sent[i].end - at) < std::abs(sent[best].end - at))))
+                {
+                    best = i;
+                }
+            }
+            if ((best == sent.size()) || (raw->body.size() != (sent[best].frame.size() - 1U)))
+            {
+                continue;   // A false detection in the noise.
+            }
+            matched[best] = true;
+            out.detected++;
+            for (std::size_t i = 0; i < raw->body.size(); i++)
+            {
+                out.bit_errors += static_cast<unsigned>(__builtin_popcount(raw->body[i] ^ sent[best].frame[i + 1U]));
+            }
+            out.bit_count += raw->body.size() * 8U;
+            if (const auto data = decode(*raw, options.fec_kind); data && (*data == sent[best].data))
+            {
+                out.delivered++;
+            }
+        }
+    }
+    catch (const EndOfSimulation&)
+    {
+    }
+    return out;
+}
+
+template <std::size_t Index = 0>
+static void simulateAll(const Options& options)
+{
+    if constexpr (Index < std::variant_size_v<side_channel::params::Profile>)
+    {
+        using P = std::variant_alternative_t<Index, side_channel::params::Profile>;
+        const bool selected = options.profiles.empty() ||
+            (std::find(std::begin(options.profiles), std::end(options.profiles), P::Name) !=
+             std::end(options.profiles));
+        for (auto scale : options.scales)
+        {
+            for (auto noise : options.noise_levels)
+            {
+                if (!selected)
+                {
+                    break;
+                }
+                const auto r = simulate<P>(options, scale, noise);
+                const double chip_ms = std::chrono::duration<double, std::milli>(P::ChipPeriod).count() * scale;
+                const double raw_bps = P::SymbolBits / (std::chrono::duration<double>(P::SymbolPeriod).count() * scale);
+                char ber[16] = "-";     // Undefined if no frames were detected.
+                if (r.bit_count > 0U)
+                {
+                    (void)std::snprintf(ber, sizeof(ber), "%.2e", double(r.bit_errors) / double(r.bit_count));
+                }
+                std::printf("%-12s %8.1f %9.1f %6.2f %6u %8u %9u %10s %6.3f %12.3f\n",
+                            P::Name,
+                            chip_ms,
+                            raw_bps,
+                            noise,
+                            options.frame_count,
+                            r.detected,
+                            r.delivered,
+                            ber,
+                            1.0 - (double(r.delivered) / double(options.frame_count)),
+                            (double(r.delivered) * double(options.data_size) * 8.0) / r.duration_s);
+                std::fflush(stdout);
+            }
+        }
+        simulateAll<Index + 1U>(options);
+    }
+}
+
+static std::vector<double> parseList(const std::string& arg)
+{
+    std::vector<double> out;
+    std::istringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        out.push_back(std::stod(item));
+    }
+    return out;
+}
+
+int main(const int argc, const char* const argv[])
+{
+    Options options;
+    bool ok = true;
+    for (auto i = 1; i < argc; i++)
+    {
+        const std::string arg(argv[i]);
+        if (arg.rfind("--profile=", 0) == 0)
+        {
+            options.profiles.push_back(arg.substr(10));
+            ok = ok && side_channel::params::findProfile(std::string_view(options.profiles.back())).has_value();
+        }
+        else if (arg.rfind("--scale=", 0) == 0)
+        {
+            options.scales = parseList(arg.substr(8));
+        }
+        else if (arg.rfind("--noise=", 0) == 0)
+        {
+            options.noise_levels = parseList(arg.substr(8));
+        }
+        else if (arg.rfind("--jitter=", 0) == 0)
+        {
+            options.model.jitter = std::chrono::nanoseconds(std::stoll(arg.substr(9)));
+        }
+        else if (arg.rfind("--drift=", 0) == 0)
+        {
+            options.model.drift_ppm = std::stod(arg.substr(8));
+        }
+        else if (arg.rfind("--frames=", 0) == 0)
+        {
+            options.frame_count = static_cast<unsigned>(std::stoul(arg.substr(9)));
+        }
+        else if (arg.rfind("--burst=", 0) == 0)
+        {
+            options.burst_size = static_cast<unsigned>(std::stoul(arg.substr(8)));
+        }
+        else if (arg.rfind("--size=", 0) == 0)
+        {
+            options.data_size = std::stoul(arg.substr(7));
+        }
+        else if (arg == "--fec")
+        {
+            options.fec_kind = side_channel::fec::Kind::Convolutional;
+        }
+        else if (arg.rfind("--seed=", 0) == 0)
+        {
+            options.seed = static_cast<unsigned>(std::stoul(arg.substr(7)));
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    ok = ok && (options.frame_count > 0U) && (options.burst_size > 0U) && !options.scales.empty() &&
+         (std::find_if(std::begin(options.scales), std::end(options.scales), [](double x) { return x <= 0.0; }) ==
+          std::end(options.scales));
+    if (!ok)
+    {
+        std::cerr << "Usage:\n\t" << argv[0]
+                  << " [--profile=NAME]... [--scale=1,2,4] [--noise=0.5,1,2] [--jitter=NS] [--drift=PPM]"
+                     " [--frames=N] [--burst=N] [--size=BYTES] [--fec] [--seed=N]" << std::endl;
+        return 1;
+    }
+    std::printf("Jitter %lld ns, drift %+.1f ppm, %u frames of %u bytes in bursts of %u, FEC %s.\n",
+                static_cast<long long>(options.model.jitter.count()),
+                options.model.drift_ppm,
+                options.frame_count,
+                static_cast<unsigned>(options.data_size),
+                options.burst_size,
+                (options.fec_kind == side_channel::fec::Kind::None) ? "off" : "on");
+    std::printf("%-12s %8s %9s %6s %6s %8s %9s %10s %6s %12s\n",
+                "profile", "chip_ms", "raw_bps", "noise", "sent", "detected", "delivered", "ber", "fer", "goodput_bps");
+    simulateAll(options);
+    return 0;
+}
@@ -1,145 +1,409 @@
 /// Pavel Kirienko <pavel@uavcan.org>
 /// Distributed under the terms of the MIT license.
-/// g++ -std=c++17 -O2 -Wall tx.cpp -lpthread -o tx && ./tx
+/// g++ -std=c++17 -O2 -march=native -Wall tx.cpp -lpthread -o tx && ./tx
 
 #include "side_channel_params.hpp"
+#include "side_channel_crc.hpp"
+#include "side_channel_fec.hpp"
+#include "side_channel_lanes.hpp"
+#include "side_channel_segment.hpp"
+#include "side_channel_tx.hpp"
+#include "side_channel_rx.hpp"
+#include "side_channel_arq.hpp"
+#include "side_channel_telemetry.hpp"
 #include <cstdio>
 #include <iostream>
 #include <fstream>
-#include <iterator>
+#include <random>
 #include <thread>
 #include <vector>
+#include <array>
 #include <atomic>
-#include <cassert>
 #include <stdexcept>
+#include <optional>
+#include <chrono>
+#include <string>
 
-static void drivePHY(const bool level, const std::chrono::nanoseconds duration)
+/// The number of segments per burst limits the memory footprint and the time the receiver has to wait if the profile
+/// announcement is lost.
+static constexpr std::size_t SegmentsPerBurst = 16;
+
+/// The settings of the transfer that are shared by all lanes.
+struct Transfer
 {
-    // Use delta relative to fixed state to avoid accumulation of phase error, because phase error attenuates the
-    // useful signal at the receiver.
-    static auto deadline = std::chrono::steady_clock::now();
-    deadline += duration;
-    if (level)
-    {
-        std::atomic<bool> finish = false;
-        const auto loop = [&finish]() {
-            while (!finish)
-            {
-                // This busyloop is only needed to generate dummy CPU load between possibly contentious checks.
-                volatile std::uint16_t i = 1;
-                while (i != 0)
-                {
-                    i = i + 1U;
-                }
-            }
-        };
-        static const auto thread_count = std::max<unsigned>(1, std::min<unsigned>(MAX_CONCURRENCY,
-                                                                                  std::thread::hardware_concurrency()));
-        std::vector<std::thread> pool;
-        assert(thread_count > 0);
-        for (auto i = 0U; i < (thread_count - 1); i++)
-        {
-            pool.emplace_back(loop);
-        }
-        while (std::chrono::steady_clock::now() < deadline)
-        {
-            volatile std::uint16_t i = 1;  // Dummy load in case now() is blocking.
-            while (i != 0)
-            {
-                i = i + 1U;
-            }
-        }
-        finish = true;
-        for (auto& t : pool)
-        {
-            t.join();
-        }
+    std::string path;
+    side_channel::segment::Header header;   ///< The index is assigned per segment.
+    std::uint64_t file_size = 0;
+    side_channel::crc::Kind crc_kind{};
+    side_channel::fec::Kind fec_kind{};
+    std::uint8_t preamble_length = 0;
+};
+
+/// Reads the segment of the file with the specified index and returns its frame.
+static std::vector<std::uint8_t> makeSegmentFrame(std::ifstream&             ifs,
+                                                  const Transfer&            transfer,
+                                                  const std::uint32_t        index,
+                                                  std::vector<std::uint8_t>& buf)
+{
+    auto header = transfer.header;
+    header.index = index;
+    const auto size = static_cast<std::size_t>(
+        std::min<std::uint64_t>(header.segment_size, transfer.file_size - header.getOffset()));
+    buf.resize(header.segment_size);
+    ifs.seekg(static_cast<std::streamoff>(header.getOffset()));
+    if (!ifs.read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(size)))
+    {
+        throw std::runtime_error("Cannot read file " + transfer.path);
     }
-    else
+    std::printf("segment %u/%u\n", static_cast<unsigned>(index + 1U), static_cast<unsigned>(header.count));
+    return side_channel::tx::makeFrame(side_channel::params::FrameType::Segment,
+                                       side_channel::segment::makeSegment(header, buf.data(), size),
+                                       transfer.crc_kind,
+                                       transfer.fec_kind);
+}
+
+static std::ifstream openFile(const Transfer& transfer)
+{
+    std::ifstream ifs(transfer.path, std::ios::binary);
+    if (!ifs)
     {
-        std::this_thread::sleep_for(deadline - std::chrono::steady_clock::now());
+        throw std::logic_error("Cannot read file " + transfer.path);
     }
+    return ifs;
 }
 
-static void emitBit(const bool value)
+/// The timing of the chip edges of the lane is printed once the transfer is finished; see side_channel_timer.hpp.
+static void printTiming(const side_channel::telemetry::TimerMetrics& timing)
 {
-    using side_channel::params::ChipPeriod;
-    using side_channel::params::CDMACode;
+    std::printf("TIMING: %s\n", side_channel::telemetry::format(timing).c_str());
+}
 
-    for (auto i = 0U; i < CDMACode.size(); i++)
+/// Sends the segments of the lane: segment K is sent over lane K % lane_count. The file is read one burst at a time,
+/// and each lane reads it independently, so the memory footprint does not depend on the size of the file.
+template <typename Profile>
+static void emitLane(side_channel::tx::PHYDriver& driver,
+                     const unsigned               prn,
+                     const unsigned               lane,
+                     const unsigned               lane_count,
+                     const Transfer&              transfer)
+{
+    auto ifs = openFile(transfer);
+    std::vector<std::uint8_t> buf;
+    std::vector<std::vector<std::uint8_t>> frames;
+    for (auto index = lane; index < transfer.header.count; index += lane_count)
     {
-        const bool code_position = CDMACode[i];
-        const bool bit = value ? code_position : !code_position;
-        drivePHY(bit, ChipPeriod);
+        frames.push_back(makeSegmentFrame(ifs, transfer, index, buf));
+        if ((frames.size() >= SegmentsPerBurst) || ((index + lane_count) >= transfer.header.count))
+        {
+            side_channel::tx::emitBurst<Profile>(driver, prn, frames, transfer.fec_kind, transfer.preamble_length);
+            frames.clear();
+        }
     }
 }
 
-/// Each byte is preceded by a single high start bit.
-static void emitByte(const std::uint8_t data)
+/// The first lane is driven by the calling thread, which is bound to the first core of the lane in main(); each other
+/// lane is driven by its own thread bound to the first core of the lane. The lanes are not synchronized with each
+/// other because each lane is received by its own correlator.
+template <typename Profile>
+static void emitFile(const unsigned prn, const unsigned lane_count, const Transfer& transfer)
 {
-    auto i = sizeof(data) * 8U;
-    std::printf("byte 0x%02x\n", data);
-    emitBit(1); // START BIT
-    while (i --> 0)
+    std::vector<std::thread> threads;
+    for (auto lane = 1U; lane < lane_count; lane++)
+    {
+        threads.emplace_back([prn, lane, lane_count, &transfer]()
+        {
+            const auto cores = side_channel::lanes::getLaneCores(lane, lane_count);
+            side_channel::initThread(cores.front());
+            side_channel::telemetry::TimerMetrics timing("lane" + std::to_string(lane));
+            side_channel::tx::PHYDriver driver(cores);
+            driver.setTelemetry(&timing);
+            emitLane<Profile>(driver, prn + lane, lane, lane_count, transfer);
+            printTiming(timing);
+        });
+    }
+    const auto cores = side_channel::lanes::getLaneCores(0, lane_count);
+    side_channel::telemetry::TimerMetrics timing("lane0");
+    side_channel::tx::PHYDriver driver(cores);
+    driver.setTelemetry(&timing);
+    emitLane<Profile>(driver, prn, 0, lane_count, transfer);
+    printTiming(timing);
+    for (auto& t : threads)
     {
-        const bool bit = (static_cast<std::uintmax_t>(data) & (1ULL << i)) != 0U;
-        emitBit(bit);
+        t.join();
     }
 }
 
-/// The delimiter shall be at least 9 zero bits long (longer is ok).
-/// Longer delimiter allows the reciever to find correlation before the data transmission is started.
-static void emitFrameDelimiter()
+/// Listens to the reverse channel until the acknowledgement of the file is received or the timeout expires.
+/// The PHY is sampled only while listening, because the link is half-duplex; see side_channel_arq.hpp.
+static std::optional<side_channel::arq::Ack> receiveAck(const unsigned                 ack_prn,
+                                                        const std::uint32_t            file_id,
+                                                        const std::chrono::nanoseconds timeout)
 {
-    std::printf("delimiter\n");
-    for (auto i = 0U; i < 20; i++)
+    const auto deadline = side_channel::FastClock::now() + timeout;
+    side_channel::rx::Sampler sampler({side_channel::lanes::getLaneCores(0, 1)});
+    side_channel::rx::PacketReader reader(sampler.getPort(0), ack_prn, "ack" + std::to_string(ack_prn));
+    while (const auto frame = reader.next(deadline))
     {
-        emitBit(0);
+        if (frame->type != side_channel::params::FrameType::Ack)
+        {
+            continue;
+        }
+        const auto ack = side_channel::arq::parseAck(frame->payload);
+        if (ack && (ack->file_id == file_id))
+        {
+            return ack;
+        }
     }
+    return {};
 }
 
-static void emitPacket(const std::vector<std::uint8_t>& data)
+/// Sends the file using the selective repeat ARQ: each burst carries the segments of the window that are not yet
+/// acknowledged, followed by the poll; then the transmitter listens for the acknowledgement and slides the window.
+/// If the acknowledgement is lost, the same segments are sent again.
+template <typename Profile>
+static void emitFileARQ(const unsigned prn, const unsigned ack_prn, const Transfer& transfer)
 {
-    emitFrameDelimiter();
-    std::uint16_t crc = side_channel::CRCInitial;
-    for (std::uint8_t v : data)
+    using side_channel::arq::WindowSize;
+    const auto count = transfer.header.count;
+    const auto timeout = side_channel::arq::getAckTimeout(side_channel::params::PreambleLength);
+    auto ifs = openFile(transfer);
+    std::vector<std::uint8_t> buf;
+    std::vector<bool> acked(count, false);
+    std::uint32_t base = 0;
+    unsigned retries = 0;
+    side_channel::telemetry::TimerMetrics timing("lane0");     // Accumulated across the bursts.
+    while (base < count)
     {
-        emitByte(v);
-        crc = side_channel::crcAdd(crc, v);
+        std::vector<std::vector<std::uint8_t>> frames;
+        for (auto index = base; (index < count) && ((index - base) < WindowSize); index++)
+        {
+            if (!acked[index] && (frames.size() < SegmentsPerBurst))
+            {
+                frames.push_back(makeSegmentFrame(ifs, transfer, index, buf));
+            }
+        }
+        frames.push_back(side_channel::tx::makeFrame(side_channel::params::FrameType::Poll,
+                                                     side_channel::arq::makePoll(transfer.header.file_id),
+                                                     side_channel::crc::Kind::CRC16CCITT,
+                                                     transfer.fec_kind));
+        {
+            // The driver is created anew for every burst because its deadline shall not lag behind.
+            side_channel::tx::PHYDriver driver(side_channel::lanes::getLaneCores(0, 1));
+            driver.setTelemetry(&timing);
+            side_channel::tx::emitBurst<Profile>(driver, prn, frames, transfer.fec_kind, transfer.preamble_length);
+        }
+        const auto ack = receiveAck(ack_prn, transfer.header.file_id, timeout);
+        if (!ack)
+        {
+            if (++retries > side_channel::arq::MaxRetries)
+            {
+                throw std::runtime_error("The receiver does not acknowledge the file");
+            }
+            std::printf("acknowledgement not received, retry %u/%u\n", retries, side_channel::arq::MaxRetries);
+            continue;
+        }
+        retries = 0;
+        std::this_thread::sleep_for(side_channel::arq::getTurnaroundDelay());
+        for (auto index = base; index < count; index++)
+        {
+            acked[index] = acked[index] || ack->isReceived(index);
+        }
+        while ((base < count) && acked[base])
+        {
+            base++;
+        }
+        std::printf("acknowledged %u/%u\n", static_cast<unsigned>(base), static_cast<unsigned>(count));
     }
-    emitByte(static_cast<std::uint8_t>(crc >> 8U));
-    emitByte(static_cast<std::uint8_t>(crc >> 0U));
-    emitFrameDelimiter();
+    printTiming(timing);
 }
 
-static std::vector<std::uint8_t> readFile(const std::string& path)
+/// CRC-16 is too weak for large packets, so CRC-32C is used for them unless specified otherwise.
+static side_channel::crc::Kind selectCRC(const std::size_t data_size, const std::string& arg)
 {
-    std::ifstream ifs(path, std::ios::binary);
-    if (ifs)
-    {
-        ifs.unsetf(std::ios::skipws);
-        ifs.seekg(0, std::ios::end);
-        std::vector<std::uint8_t> buf;
-        buf.reserve(ifs.tellg());
-        ifs.seekg(0, std::ios::beg);
-        buf.insert(buf.begin(), std::istream_iterator<std::uint8_t>(ifs), std::istream_iterator<std::uint8_t>());
-        return buf;
-    }
-    throw std::logic_error("Cannot read file " + path);
+    if (arg == "crc16")
+    {
+        return side_channel::crc::Kind::CRC16CCITT;
+    }
+    if (arg == "crc32c")
+    {
+        return side_channel::crc::Kind::CRC32C;
+    }
+    if (!arg.empty())
+    {
+        throw std::invalid_argument("Unknown CRC kind " + arg);
+    }
+    static constexpr std::size_t CRC16MaxDataSize = 4096;
+    return (data_size > CRC16MaxDataSize) ? side_channel::crc::Kind::CRC32C : side_channel::crc::Kind::CRC16CCITT;
+}
+
+static side_channel::fec::Kind selectFEC(const std::string& arg)
+{
+    if (arg == "conv")
+    {
+        return side_channel::fec::Kind::Convolutional;
+    }
+    if (!arg.empty() && (arg != "none"))
+    {
+        throw std::invalid_argument("Unknown FEC kind " + arg);
+    }
+    return side_channel::fec::Kind::None;
 }
 
 int main(const int argc, const char* const argv[])
 {
-    std::cout << "SPREAD CODE LENGTH: " << side_channel::params::CDMACodeLength << " bit" << std::endl;
-    std::cout << "SPREAD CHIP PERIOD: " << side_channel::params::ChipPeriod.count() * 1e-6 << " ms" << std::endl;
-    if (argc < 2)
+    std::string path;
+    std::string crc_arg;
+    std::string fec_arg;
+    std::string profile_arg = side_channel::params::RobustProfile::Name;
+    unsigned prn = 1;
+    unsigned lane_count = 1;
+    unsigned preamble_length = side_channel::params::PreambleLength;
+    std::size_t segment_size = side_channel::segment::DefaultSegmentSize;
+    bool arq = false;
+    std::optional<unsigned> ack_prn;
+    side_channel::ExecutionProfile execution;
+    for (auto i = 1; i < argc; i++)
     {
-        std::cerr << "Usage:\n\t" << argv[0] << " <file>" << std::endl;
+        const std::string arg(argv[i]);
+        if (arg.rfind("--crc=", 0) == 0)
+        {
+            crc_arg = arg.substr(6);
+        }
+        else if (arg.rfind("--fec=", 0) == 0)
+        {
+            fec_arg = arg.substr(6);
+        }
+        else if (arg.rfind("--prn=", 0) == 0)
+        {
+            prn = static_cast<unsigned>(std::stoul(arg.substr(6)));
+        }
+        else if (arg.rfind("--profile=", 0) == 0)
+        {
+            profile_arg = arg.substr(10);
+        }
+        else if (arg.rfind("--lanes=", 0) == 0)
+        {
+            lane_count = static_cast<unsigned>(std::stoul(arg.substr(8)));
+        }
+        else if (arg.rfind("--preamble=", 0) == 0)
+        {
+            preamble_length = static_cast<unsigned>(std::stoul(arg.substr(11)));
+        }
+        else if (arg.rfind("--segment=", 0) == 0)
+        {
+            segment_size = std::stoul(arg.substr(10));
+        }
+        else if (arg == "--arq")
+        {
+            arq = true;
+        }
+        else if (arg.rfind("--ack-prn=", 0) == 0)
+        {
+            ack_prn = static_cast<unsigned>(std::stoul(arg.substr(10)));
+        }
+        else if (path.empty() && (arg.rfind("--", 0) != 0))
+        {
+            path = arg;
+        }
+        else if (side_channel::parseExecutionOption(arg, execution))
+        {
+            // Applied after all options are parsed.
+        }
+        else
+        {
+            path.clear();
+            break;
+        }
+    }
+    // The execution profile is applied first because it defines the cores available to the PHY.
+    for (const auto& warning : side_channel::applyExecutionProfile(execution))
+    {
+        std::cerr << "WARNING: " << warning << std::endl;
+    }
+    const auto profile = side_channel::params::findProfile(profile_arg);
+    if (path.empty() || !profile || !side_channel::lanes::isLaneCountValid(lane_count) || (preamble_length > 255U) ||
+        (segment_size == 0U) || (segment_size > side_channel::segment::MaxSegmentSize) ||
+        (arq && ((lane_count != 1U) || (ack_prn.value_or(prn + 1U) == prn))))
+    {
+        std::cerr << "Usage:\n\t" << argv[0]
+                  << " [--prn=N] [--crc=crc16|crc32c] [--fec=none|conv] [--profile=NAME] [--lanes=1.."
+                  << side_channel::getThreadCount() << "] [--preamble=SYMBOLS] [--segment=1.."
+                  << side_channel::segment::MaxSegmentSize << "] [--arq [--ack-prn=N]]\n\t\t"
+                  << side_channel::ExecutionOptionUsage << " <file>\n"
+                  << "The ARQ mode requires one lane; the acknowledgements are received using PRN+1 by default.\n"
+                  << "Profiles:";
+        for (auto id = 0U; id < std::variant_size_v<side_channel::params::Profile>; id++)
+        {
+            std::visit([](auto p) { std::cerr << " " << decltype(p)::Name; },
+                       *side_channel::params::findProfile(static_cast<std::uint8_t>(id)));
+        }
+        std::cerr << std::endl;
         return 1;
     }
-    side_channel::initThread();
-    const auto data = readFile(argv[1]);
-    std::cerr << "Transmitting " << data.size() << " bytes read from " << argv[1] << std::endl;
-    emitPacket(data);
+    std::visit([prn, lane_count](auto p)
+    {
+        using P = decltype(p);
+        // Fail early if the PRN number of any lane is not valid for the selected profile.
+        (void) P::getCode(prn + lane_count - 1U);
+        (void) side_channel::params::RobustProfile::getCode(prn + lane_count - 1U);
+        std::cout << "LINK PROFILE:       " << P::Name << std::endl;
+        std::cout << "SPREAD CODE LENGTH: " << P::CodeLength << " bit" << std::endl;
+        std::cout << "SPREAD CHIP PERIOD: " << P::ChipPeriod.count() * 1e-6 << " ms" << std::endl;
+    }, *profile);
+    std::cout << "CLOCK SOURCE:       " << side_channel::FastClock::getSourceName() << std::endl;
+    std::cout << "PHY BACKEND:        " << side_channel::backend::Default::Name << std::endl;
+    std::cout << "CPU TOPOLOGY:       " << side_channel::topology::describe(side_channel::topology::getTopology())
+              << std::endl;
+    std::cout << "EXECUTION PROFILE:  " << side_channel::describeExecutionProfile(side_channel::getExecutionProfile())
+              << std::endl;
+    std::cout << "TRANSMITTING PRN:   " << prn << std::endl;
+    if (arq)
+    {
+        ack_prn = ack_prn.value_or(prn + 1U);
+        (void) side_channel::params::RobustProfile::getCode(*ack_prn);
+        std::cout << "ACK PRN:            " << *ack_prn << std::endl;
+    }
+    std::cout << "PREAMBLE LENGTH:    " << preamble_length << " symbols" << std::endl;
+    for (auto lane = 0U; lane < lane_count; lane++)
+    {
+        std::cout << "LANE " << lane << " PRN " << (prn + lane) << " CPUS:";
+        for (auto core : side_channel::lanes::getLaneCores(lane, lane_count))
+        {
+            std::cout << " " << side_channel::getCPU(core);
+        }
+        std::cout << std::endl;
+    }
+    // The calling thread drives the first lane, whose first core is the PHY core 0.
+    side_channel::initThread(0);
+    Transfer transfer;
+    transfer.path = path;
+    if (std::ifstream ifs(path, std::ios::binary | std::ios::ate); ifs)
+    {
+        transfer.file_size = static_cast<std::uint64_t>(ifs.tellg());
+    }
+    else
+    {
+        throw std::logic_error("Cannot read file " + path);
+    }
+    transfer.header.file_id = std::random_device{}();
+    transfer.header.count = side_channel::segment::getSegmentCount(transfer.file_size, segment_size);
+    transfer.header.segment_size = static_cast<std::uint16_t>(segment_size);
+    transfer.crc_kind = selectCRC(segment_size, crc_arg);
+    transfer.fec_kind = selectFEC(fec_arg);
+    transfer.preamble_length = static_cast<std::uint8_t>(preamble_length);
+    std::cerr << "Transmitting " << transfer.file_size << " bytes read from " << path << " in "
+              << transfer.header.count << " segments as file " << std::hex << transfer.header.file_id << std::dec
+              << std::endl;
+    std::visit([&](auto p)
+    {
+        if (arq)
+        {
+            emitFileARQ<decltype(p)>(prn, *ack_prn, transfer);
+        }
+        else
+        {
+            emitFile<decltype(p)>(prn, lane_count, transfer);
+        }
+    }, *profile);
     return 0;
 }